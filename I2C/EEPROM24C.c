@@ -0,0 +1,116 @@
+#include "EEPROM24C.h"
+#include <string.h>
+
+uint8_t _EEPROM24C_header(EEPROM24C* eeprom, uint16_t memory_address, uint8_t* header, uint8_t* slave_address);
+uint16_t _EEPROM24C_default_poll_limit(uint8_t slave_address);
+
+//Splits data into page aligned bursts, the write cycle of each page is
+//overlapped with the caller until the next access (see EEPROM24C_wait_ready)
+enum I2CTransmissionResult EEPROM24C_write(EEPROM24C* eeprom, uint16_t memory_address, uint8_t* data, uint16_t length)
+{
+	if (eeprom -> page_size == 0 || eeprom -> page_size > EEPROM24C_PAGE_MAX) return INTERNAL_ERROR;
+	
+	uint8_t frame[2 + EEPROM24C_PAGE_MAX];
+	
+	while (length)
+	{
+		//Bytes left until the end of the current page
+		uint16_t burst = eeprom -> page_size - (memory_address & (eeprom -> page_size - 1));
+		if (burst > length) burst = length;
+		
+		enum I2CTransmissionResult result = EEPROM24C_wait_ready(eeprom);
+		if (result != SUCCESS) return result;
+		
+		uint8_t slave_address;
+		uint8_t header_length = _EEPROM24C_header(eeprom, memory_address, frame, &slave_address);
+		memcpy(frame + header_length, data, burst);
+		
+		I2CMasterTransmission transmission = {.stream = {.buffer = (char*)frame, .length = header_length + burst}, .slave_address = slave_address};
+		
+		result = I2C_start_transmission(&transmission);
+		if (result != SUCCESS) return result;
+		
+		eeprom -> busy = 1;
+		
+		memory_address += burst;
+		data += burst;
+		length -= burst;
+	}
+	
+	return SUCCESS;
+}
+
+//Sequential read of any length in a single transaction
+enum I2CTransmissionResult EEPROM24C_read(EEPROM24C* eeprom, uint16_t memory_address, uint8_t* data, uint16_t length)
+{
+	enum I2CTransmissionResult result = EEPROM24C_wait_ready(eeprom);
+	if (result != SUCCESS) return result;
+	
+	uint8_t header[2];
+	uint8_t slave_address;
+	uint8_t header_length = _EEPROM24C_header(eeprom, memory_address, header, &slave_address);
+	
+	I2CMasterTransmission write = {.stream = {.buffer = (char*)header, .length = header_length}, .slave_address = slave_address};
+	I2CMasterTransmission read = {.stream = {.buffer = (char*)data, .length = length}, .slave_address = slave_address, .config = TCONFIG_MODE_READ};
+	
+	return I2C_start_combined_transmission(&write, &read);
+}
+
+//ACK polling: the device does not acknowledge its address until the write cycle is done
+enum I2CTransmissionResult EEPROM24C_wait_ready(EEPROM24C* eeprom)
+{
+	if (!eeprom -> busy) return SUCCESS;
+	
+	uint8_t dummy;
+	I2CMasterTransmission transmission = {.stream = {.buffer = (char*)&dummy, .length = 0}, .slave_address = eeprom -> address};
+	
+	uint16_t limit = eeprom -> poll_limit? eeprom -> poll_limit : _EEPROM24C_default_poll_limit(eeprom -> address);
+	
+	for (uint16_t i = 0; limit == EEPROM24C_POLL_UNLIMITED || i < limit; i++)
+	{
+		enum I2CTransmissionResult result = I2C_start_transmission(&transmission);
+		
+		if (result == SUCCESS)
+		{
+			eeprom -> busy = 0;
+			return SUCCESS;
+		}
+		
+		if (transmission.status != MT_SLAW_NACK) return result;
+	}
+	
+	return UNEXPECTED_STATE;
+}
+
+//Number of polls that take about EEPROM24C_POLL_MS at the bit rate the polls to slave_address run at
+//TWBR/TWSR may still hold the bit rate of a transmission to another device
+uint16_t _EEPROM24C_default_poll_limit(uint8_t slave_address)
+{
+	I2CDeviceTiming timing = I2C_get_device_timing(slave_address);
+	
+	//SCL period in CPU cycles: 16 + 2 * TWBR * 4^TWPS
+	uint32_t bit_cycles = 16 + 2UL * timing.twbr * (1 << (2 * timing.twps));
+	
+	//START, SLA+W, NACK and STOP take about 11 bit times
+	return F_CPU / 1000 * EEPROM24C_POLL_MS / (11 * bit_cycles) + 1;
+}
+
+//Fills header with the memory address bytes
+//Returns header length
+uint8_t _EEPROM24C_header(EEPROM24C* eeprom, uint16_t memory_address, uint8_t* header, uint8_t* slave_address)
+{
+	if (eeprom -> address_bytes == 1)
+	{
+		//24C04 - 24C16: address bits 8 - 10 select the block through the slave address
+		*slave_address = eeprom -> address | ((memory_address >> 8) & 0x07);
+		header[0] = memory_address & 0xFF;
+		
+		return 1;
+	}
+	
+	*slave_address = eeprom -> address;
+	header[0] = memory_address >> 8;
+	header[1] = memory_address & 0xFF;
+	
+	return 2;
+}
@@ -0,0 +1,31 @@
+#ifndef EEPROM24C_H_
+#define EEPROM24C_H_
+
+#include "I2C.h"
+
+//Largest page of the supported parts (24C256: 64 bytes), bounds the write buffer on stack
+#ifndef EEPROM24C_PAGE_MAX
+	#define EEPROM24C_PAGE_MAX 64
+#endif
+
+//Default ACK polling budget, write cycles of 24Cxx parts take up to 5 - 10 ms
+#ifndef EEPROM24C_POLL_MS
+	#define EEPROM24C_POLL_MS 10
+#endif
+
+//poll_limit value that keeps polling until the device answers
+#define EEPROM24C_POLL_UNLIMITED 0xFFFF
+
+typedef struct EEPROM24C{
+	uint8_t address; //Base slave address, 0x50 - 0x57
+	uint8_t address_bytes; //1 for 24C01 - 24C16 (upper address bits go into the slave address), 2 for 24C32 and up
+	uint8_t page_size; //Power of 2, at most EEPROM24C_PAGE_MAX
+	uint16_t poll_limit; //Maximum SLA+W attempts while waiting for a write cycle, 0 = about EEPROM24C_POLL_MS at the bit rate of address (see I2C_set_device_timings)
+	uint8_t busy; //Write cycle may be in progress, managed by the driver
+} EEPROM24C;
+
+enum I2CTransmissionResult EEPROM24C_write(EEPROM24C* eeprom, uint16_t memory_address, uint8_t* data, uint16_t length);
+enum I2CTransmissionResult EEPROM24C_read(EEPROM24C* eeprom, uint16_t memory_address, uint8_t* data, uint16_t length);
+enum I2CTransmissionResult EEPROM24C_wait_ready(EEPROM24C* eeprom);
+
+#endif
@@ -1,5 +1,12 @@
 #include "I2C.h"
 
+//Empty on parts without TWI, see I2CProtocol.c
+#ifdef I2C_FEATURE_TWI
+
+#ifdef I2C_FEATURE_LOW_POWER
+	#include <avr/sleep.h>
+#endif
+
 //https://www.arnabkumardas.com/arduino-tutorial/i2c-register-description/
 //https://ww1.microchip.com/downloads/en/DeviceDoc/Atmel-7810-Automotive-Microcontrollers-ATmega328P_Datasheet.pdf#G1199017
 #define TWCR_INT 0x80 //TWI interrupt flag
@@ -15,28 +22,89 @@
 
 #define TWAR_GCE 0x01 //TWI General call recognition enable bit
 
+#ifdef I2C_FEATURE_TRACE
+	I2CTraceEntry _I2C_trace[I2C_TRACE_SIZE];
+	uint16_t _I2C_trace_count;
+	
+	//Master routines run with the TWI interrupt disabled, so the ISR never races them
+	#define _I2C_TRACE(trace_status) do {\
+		I2CTraceEntry* entry = &_I2C_trace[_I2C_trace_count++ & (I2C_TRACE_SIZE - 1)];\
+		entry -> status = trace_status;\
+		entry -> data = TWDR;\
+		entry -> tick = I2C_TRACE_TICK;\
+	} while(0)
+#else
+	#define _I2C_TRACE(trace_status)
+#endif
+
+#ifdef I2C_FEATURE_MASTER
 uint8_t _I2C_set_frequency(uint32_t frequency);
-enum I2CTransmissionResult _I2C_m_send(I2CMasterTransmission* transmission);
-enum I2CTransmissionResult _I2C_m_request(I2CMasterTransmission* transmission);
+void _I2C_m_begin(uint8_t slave_address);
+enum I2CTransmissionResult _I2C_m_end(enum I2CTransmissionResult result);
+
+//TWI backend
+void _I2C_twi_start();
+void _I2C_twi_write(uint8_t value);
+void _I2C_twi_read(uint8_t ack);
+enum I2CTransmissionStatus _I2C_twi_wait();
+uint8_t _I2C_twi_data();
+
+const I2CMasterBackend _I2C_twi_backend = {_I2C_twi_start, _I2C_twi_write, _I2C_twi_read, _I2C_twi_wait, _I2C_twi_data};
+#endif
 
 #ifdef I2C_BUFFERED_MODE
 	void _I2C_on_receive_invoke();
-	uint8_t _I2C_write_to_stream(I2CStream* stream, uint16_t new_length,uint8_t value);
 	uint8_t _I2C_trim_stream(I2CStream* stream);
+	
+	//SR status handlers
+	void _I2C_status_SR_SLAW_ACK();
+	void _I2C_status_SR_ARB_LOST_SLAW_ACK();
+	void _I2C_status_SR_ARB_LOST_GC_ACK();
+	void _I2C_status_SR_GC_ACK();
+	void _I2C_status_SR_DATA_ACK();
+	void _I2C_status_SR_DATA_NACK();
+	void _I2C_status_SR_GC_DATA_ACK();
+	void _I2C_status_SR_GC_DATA_NACK();
+	void _I2C_status_SR_STOP_REPSTART();
 #endif
 
-//SR status handlers
-void _I2C_status_SR_SLAW_ACK();
-void _I2C_status_SR_ARB_LOST_SLAW_ACK();
-void _I2C_status_SR_ARB_LOST_GC_ACK();
-void _I2C_status_SR_GC_ACK();
-void _I2C_status_SR_DATA_ACK();
-void _I2C_status_SR_DATA_NACK();
-void _I2C_status_SR_GC_DATA_ACK();
-void _I2C_status_SR_GC_DATA_NACK();
-void _I2C_status_SR_STOP_REPSTART();
+#ifdef I2C_FEATURE_SLAVE
+	//Emulated slave devices
+	void _I2C_device_dispatch(enum I2CTransmissionStatus status);
+	I2CSlaveDevice* _I2C_find_device(uint8_t address);
+	uint8_t _I2C_received_address();
+#endif
+
+#ifdef I2C_FEATURE_LOW_POWER
+	uint8_t _I2C_is_end_state(enum I2CTransmissionStatus status);
+#endif
 
 I2CConfig* _I2C_config;
+volatile uint8_t I2C_transmission_ended;
+
+#ifdef I2C_FEATURE_MASTER
+	const I2CDeviceTiming* _I2C_timings;
+	uint8_t _I2C_timing_count;
+	
+	//Bit rate for devices missing from the timing table
+	uint8_t _I2C_default_twbr;
+	uint8_t _I2C_default_twps;
+#endif
+
+#ifdef I2C_FEATURE_STATS
+	I2CStats I2C_stats;
+#endif
+
+#ifdef I2C_FEATURE_SLAVE
+	I2CSlaveDevice* _I2C_devices[I2C_SLAVE_DEVICES_MAX];
+	uint8_t _I2C_device_count;
+	I2CSlaveDevice* _I2C_current_device;
+#endif
+
+#ifdef I2C_FEATURE_LOW_POWER
+	volatile uint8_t _I2C_addressed; //Set from own address match until the transaction ends
+	volatile uint8_t _I2C_woken; //Next ISR is the address match that woke the core from power-down
+#endif
 
 #ifdef I2C_BUFFERED_MODE
 	I2CSlaveTransmission* _I2C_current_rx_transmission;
@@ -47,15 +115,42 @@ I2CConfig* _I2C_config;
 //0: Success
 //1: Invalid frequency
 //2: Invalid address
+//3: Mode not compiled in (see feature slices)
 uint8_t I2C_init(I2CConfig* config)
 {
+	#ifndef I2C_FEATURE_MASTER
+		if (config -> mode != SLAVE) return 3;
+	#endif
+	
+	//Arbitration lost to the own address is only handled with I2C_FEATURE_MULTI_MASTER
+	#ifndef I2C_FEATURE_MULTI_MASTER
+		if (config -> mode == MULTI_MASTER) return 3;
+	#endif
+	
+	#ifndef I2C_FEATURE_SLAVE
+		if (config -> mode == SLAVE) return 3;
+	#endif
+	
 	PORTC |= 0x30;
 	
-	_I2C_on_receive_handler = 0;
+	#ifdef I2C_BUFFERED_MODE
+		_I2C_on_receive_handler = 0;
+	#endif
+	
 	_I2C_config = config;
 	I2C_transmission_ended = 1;
 	
-	if (config -> mode != SLAVE) if (_I2C_set_frequency(config -> frequency)) return 1;
+	#ifdef I2C_FEATURE_MASTER
+		if (config -> mode != SLAVE)
+		{
+			if (_I2C_set_frequency(config -> frequency)) return 1;
+			
+			_I2C_default_twbr = TWBR;
+			_I2C_default_twps = TWSR & TWSR_PRS;
+		}
+	#endif
+	
+	#ifdef I2C_FEATURE_SLAVE
 	if (config -> mode != MASTER) 
 	{
 		if (config -> address < 0x08 || config -> address > 0x77) return 2;
@@ -66,32 +161,213 @@ uint8_t I2C_init(I2CConfig* config)
 		TWAR = config -> address << 1;
 		TWAR |= config -> recognize_general_call? 1 : 0;
 		
-		//Enable interrupt
-		TWCR |= TWCR_INTEN;
+		//Load address mask into TWAMR register
+		TWAMR = config -> address_mask << 1;
 	}
+	#endif
 	
 	TWCR = 0;
 	//Enable ACK
 	TWCR |= TWCR_EA;
 	
+	#ifdef I2C_FEATURE_SLAVE
+		//Enable interrupt (after TWCR is cleared)
+		if (config -> mode != MASTER) TWCR |= TWCR_INTEN;
+	#endif
+	
 	return 0;
 }
 
 void I2C_enable() {TWCR |= TWCR_EN;}
 void I2C_disable() {TWCR &= ~TWCR_EN;}
-void I2C_enable_GC_recognition() {if(_I2C_config -> mode != MASTER) TWAR |= TWAR_GCE;}
-void I2C_disable_GC_recognition() {if(_I2C_config -> mode != MASTER) TWAR &= ~TWAR_GCE;}
+
+#ifdef I2C_FEATURE_STATS
+void I2C_stats_reset() {I2C_stats = (I2CStats){0};}
+#endif
+
+#ifdef I2C_FEATURE_TRACE
+//Copies up to max entries, oldest first
+//Returns number of entries copied
+uint8_t I2C_trace_dump(I2CTraceEntry* entries, uint8_t max)
+{
+	//Hold off the ISR while copying
+	uint8_t twcr = TWCR & TWCR_INTEN;
+	TWCR &= ~(TWCR_INTEN | TWCR_INT);
+	
+	uint16_t count = _I2C_trace_count < I2C_TRACE_SIZE? _I2C_trace_count : I2C_TRACE_SIZE;
+	if (count > max) count = max;
+	
+	uint16_t first = _I2C_trace_count - count;
+	for (uint8_t i = 0; i < count; i++) entries[i] = _I2C_trace[(first + i) & (I2C_TRACE_SIZE - 1)];
+	
+	TWCR = (TWCR & ~TWCR_INT) | twcr;
+	
+	return count;
+}
+
+void I2C_trace_clear() {_I2C_trace_count = 0;}
+#endif
+
+#ifdef I2C_BUFFERED_MODE
 void I2C_on_receive_subscribe(void* handler) {_I2C_on_receive_handler = handler;}
 void I2C_on_receive_unsubscribe() {_I2C_on_receive_handler = 0;}
+#endif
 
+#ifdef I2C_FEATURE_SLAVE
+void I2C_enable_GC_recognition() {if(_I2C_config -> mode != MASTER) TWAR |= TWAR_GCE;}
+void I2C_disable_GC_recognition() {if(_I2C_config -> mode != MASTER) TWAR &= ~TWAR_GCE;}
+
+//Return codes:
+//0: Success
+//1: Device table full
+//2: Invalid address
+uint8_t I2C_slave_register(I2CSlaveDevice* device)
+{
+	if (device -> address < 0x08 || device -> address > 0x77) return 2;
+	if (_I2C_device_count >= I2C_SLAVE_DEVICES_MAX) return 1;
+	
+	device -> bytes_received = 0;
+	device -> bytes_sent = 0;
+	
+	//Table is also read by ISR, TWINT is masked so a pending state is not acknowledged
+	TWCR &= ~(TWCR_INTEN | TWCR_INT);
+	_I2C_devices[_I2C_device_count++] = device;
+	TWCR = (TWCR & ~TWCR_INT) | TWCR_INTEN;
+	
+	return 0;
+}
+
+void I2C_slave_unregister(I2CSlaveDevice* device)
+{
+	TWCR &= ~(TWCR_INTEN | TWCR_INT);
+	
+	for (uint8_t i = 0; i < _I2C_device_count; i++)
+	{
+		if (_I2C_devices[i] != device) continue;
+		
+		_I2C_devices[i] = _I2C_devices[--_I2C_device_count];
+		break;
+	}
+	
+	if (_I2C_current_device == device) _I2C_current_device = NULL;
+	
+	TWCR = (TWCR & ~TWCR_INT) | TWCR_INTEN;
+}
+#endif
+
+#ifdef I2C_FEATURE_LOW_POWER
+//Enters power-down until the own address (or general call) is received, call from the idle loop
+//TWI holds SCL low from the address match until the ISR clears TWINT, which hides the oscillator startup
+//With an address mask (TWAMR) idle sleep is used, masked addresses can not be told apart after power-down
+//Return codes:
+//0: Slept
+//1: Addressed or in master mode, not slept
+uint8_t I2C_sleep_until_address()
+{
+	if (_I2C_config -> mode == MASTER) return 1;
+	
+	cli();
+	
+	//Sleeping mid-transaction would leave the TWI without clock after the address byte
+	if (_I2C_addressed)
+	{
+		sei();
+		return 1;
+	}
+	
+	//Only own address recognition wakes from power-down, TWINT is masked so no pending state is acknowledged
+	if (!(TWCR & TWCR_EA)) TWCR = (TWCR & ~TWCR_INT) | TWCR_EA;
+	
+	//Without masking only the TWAR address can match, so TWDR is not needed
+	uint8_t power_down = TWAMR == 0;
+	
+	set_sleep_mode(power_down? SLEEP_MODE_PWR_DOWN : SLEEP_MODE_IDLE);
+	sleep_enable();
+	_I2C_woken = power_down;
+	
+	#ifdef sleep_bod_disable
+		sleep_bod_disable();
+	#endif
+	
+	//Instruction after sei is executed before any pending interrupt, so no wake-up is missed
+	sei();
+	sleep_cpu();
+	sleep_disable();
+	
+	//Woken by another interrupt
+	_I2C_woken = 0;
+	
+	return 0;
+}
+
+uint8_t _I2C_is_end_state(enum I2CTransmissionStatus status)
+{
+	switch(status)
+	{
+		case SR_DATA_NACK:
+		case SR_GC_DATA_NACK:
+		case SR_STOP_REPSTART:
+		case ST_DATA_NACK:
+		case ST_DATA_DONE:
+		case M_ERR_ILLEGAL_START_STOP:
+			return 1;
+		
+		default:
+			return 0;
+	}
+}
+#endif
+
+#ifdef I2C_FEATURE_MASTER
 enum I2CTransmissionResult I2C_start_transmission(I2CMasterTransmission* transmission)
 {
 	if (transmission == NULL || transmission -> stream.buffer == NULL) return INTERNAL_ERROR;
+	if (_I2C_config -> mode == SLAVE) return ERR_SLAVE;
+	
+	_I2C_m_begin(transmission -> slave_address);
+	
+	return _I2C_m_end(_I2C_m_transmission(&_I2C_twi_backend, transmission));
+}
+
+//Write phase, repeated START, read phase, STOP
+//PEC (if enabled on read) covers both phases
+enum I2CTransmissionResult I2C_start_combined_transmission(I2CMasterTransmission* write, I2CMasterTransmission* read)
+{
+	if (write == NULL || write -> stream.buffer == NULL) return INTERNAL_ERROR;
+	if (read == NULL || read -> stream.buffer == NULL) return INTERNAL_ERROR;
+	if (_I2C_config -> mode == SLAVE) return ERR_SLAVE;
+	
+	_I2C_m_begin(write -> slave_address);
+	
+	return _I2C_m_end(_I2C_m_combined(&_I2C_twi_backend, write, read));
+}
+
+//timings: table of per-device bit rates (build entries with I2C_DEVICE_TIMING), must stay valid
+//Devices not in the table use the frequency from I2CConfig
+void I2C_set_device_timings(const I2CDeviceTiming* timings, uint8_t count)
+{
+	_I2C_timings = timings;
+	_I2C_timing_count = count;
+}
+
+//Bit rate that is selected for transmissions to slave_address: its table entry or the I2CConfig frequency
+I2CDeviceTiming I2C_get_device_timing(uint8_t slave_address)
+{
+	for (uint8_t i = 0; i < _I2C_timing_count; i++)
+	{
+		if (_I2C_timings[i].slave_address == slave_address) return _I2C_timings[i];
+	}
+	
+	return (I2CDeviceTiming){.slave_address = slave_address, .twbr = _I2C_default_twbr, .twps = _I2C_default_twps};
+}
+
+void _I2C_m_begin(uint8_t slave_address)
+{
 	if (!(TWCR & TWCR_EN)) TWCR |= TWCR_EN;
 	if (!(TWCR & TWCR_EA)) TWCR |= TWCR_EA;
-	if (_I2C_config -> mode == SLAVE) return ERR_SLAVE;
 	
-	while(!I2C_transmission_ended)
+	//Set again by the ISR when a slave transaction after lost arbitration ends
+	while(!I2C_transmission_ended);
 	I2C_transmission_ended = 0;
 	
 	//Disable interrupt
@@ -100,38 +376,78 @@ enum I2CTransmissionResult I2C_start_transmission(I2CMasterTransmission* transmi
 	//Clear STOP flag
 	TWCR &= ~TWCR_STO;
 	
-	enum I2CTransmissionResult result;
+	//Bit rate is switched while the bus is idle, before START
+	I2CDeviceTiming timing = I2C_get_device_timing(slave_address);
 	
-	if (transmission -> config & TCONFIG_MODE) result = _I2C_m_request(transmission);
-	else result = _I2C_m_send(transmission);
+	TWBR = timing.twbr;
+	TWSR = timing.twps;
+}
+
+enum I2CTransmissionResult _I2C_m_end(enum I2CTransmissionResult result)
+{
+	#ifdef I2C_FEATURE_STATS
+		//TWSR still holds the last state before STOP
+		uint8_t status = TWSR & TWSR_STATUS;
+		
+		I2C_stats.transmissions++;
+		if (result != SUCCESS) I2C_stats.errors++;
+		if (result == ARB_LOST || result == ARB_LOST_SLA) I2C_stats.arbitration_lost++;
+		if (status == MT_SLAW_NACK || status == MT_DATA_NACK || status == MR_SLAR_NACK) I2C_stats.nacks++;
+	#endif
 	
+	#ifdef I2C_FEATURE_MULTI_MASTER
 	if(result == ARB_LOST_SLA)
 	{
-		//Enable interrupt
-		TWCR |= TWCR_INTEN;
+		#ifdef I2C_FEATURE_SLAVE
+			#ifdef I2C_FEATURE_LOW_POWER
+				//Addressed as slave, no sleeping until the ISR has finished that transaction
+				_I2C_addressed = 1;
+			#endif
+			
+			//Enable interrupt, TWINT is masked so the ISR still sees the pending slave state
+			TWCR = (TWCR & ~TWCR_INT) | TWCR_INTEN;
+		#else
+			//No ISR to finish the slave transaction
+			I2C_transmission_ended = 1;
+		#endif
+		
 		return result;
 	}
+	#endif
+	
+	uint8_t stop = TWCR_STO;
+	
+	#ifdef I2C_FEATURE_MULTI_MASTER
+		//STOP is not allowed after lost arbitration (0x38), clearing TWINT releases the bus
+		if (result == ARB_LOST) stop = 0;
+	#endif
 	
-	TWCR |= TWCR_STO;
+	//ACK may have been disabled to NACK the last received byte
+	TWCR |= stop | TWCR_EA;
 	
 	TWCR |= TWCR_INT;
 	
 	I2C_transmission_ended = 1;
-
-	//Enable interrupt
-	TWCR |= TWCR_INTEN;
+	
+	#ifdef I2C_FEATURE_SLAVE
+		//Enable interrupt, without the slave slice there is no ISR(TWI_vect) to jump to
+		TWCR |= TWCR_INTEN;
+	#endif
 	
 	return result;
 }
 
-//Passing whole struct because pointer can change in next ISR
-void _I2C_on_receive_invoke() { if(_I2C_on_receive_handler) _I2C_on_receive_handler(*_I2C_current_rx_transmission);}
-
 //Return codes:
 //0: Success
 //1: Invalid address
 uint8_t _I2C_set_frequency(uint32_t frequency)
 {
+	#ifdef I2C_FREQUENCY
+		TWBR = I2C_TWBR(I2C_FREQUENCY);
+		TWSR = I2C_TWPS(I2C_FREQUENCY);
+		
+		return 0;
+	#else
 	if (frequency == 0) return 1;
 	
 	TWBR = 0;
@@ -163,16 +479,39 @@ uint8_t _I2C_set_frequency(uint32_t frequency)
 			return 0;
 		}
 		
-		PSCLR = PSCLR >> 2;
+		PSCLR = PSCLR << 2;
 	}
 	
 	return 1;
+	#endif
 }
+#endif
 
+#ifdef I2C_FEATURE_SLAVE
 ISR(TWI_vect)
 {
-	I2CTransmissionStatus status = TWSR & TWSR_STATUS;
+	enum I2CTransmissionStatus status = TWSR & TWSR_STATUS;
+	_I2C_TRACE(status);
+	
+	#ifdef I2C_FEATURE_LOW_POWER
+		_I2C_addressed = !_I2C_is_end_state(status);
+	#endif
+	
+	#ifdef I2C_BUFFERED_MODE
+	if (_I2C_device_count)
+	#endif
+	{
+		_I2C_device_dispatch(status);
+		
+		#ifdef I2C_FEATURE_LOW_POWER
+			_I2C_woken = 0;
+		#endif
+		
+		TWCR |= TWCR_INT;
+		return;
+	}
 	
+	#ifdef I2C_BUFFERED_MODE
 	switch(status)
 	{
 		case SR_SLAW_ACK:
@@ -200,7 +539,7 @@ ISR(TWI_vect)
 			break;
 		
 		case SR_GC_DATA_ACK:
-			_I2C_status_SR_GC_DATA_ACK()
+			_I2C_status_SR_GC_DATA_ACK();
 			break;
 		
 		case SR_GC_DATA_NACK:
@@ -210,223 +549,245 @@ ISR(TWI_vect)
 		case SR_STOP_REPSTART:
 			_I2C_status_SR_STOP_REPSTART();
 			break;
+		
+		//Nothing to transmit in buffered mode
+		case ST_SLAR_ACK:
+		case ST_ARB_LOST_SLAR_ACK:
+		case ST_DATA_ACK:
+			TWDR = 0xFF;
+			break;
+		
+		case ST_DATA_NACK:
+		case ST_DATA_DONE:
+			TWCR |= TWCR_EA;
+			I2C_transmission_ended = 1;
+			break;
+		
+		default:
+			break;
 	}
 	
+	#ifdef I2C_FEATURE_LOW_POWER
+		_I2C_woken = 0;
+	#endif
+	
 	TWCR |= TWCR_INT;
+	#endif
 }
 
-void _I2C_status_SR_SLAW_ACK()
+//TWDR holds the received SLA+R/W, masked bits included
+uint8_t _I2C_received_address()
 {
-	if(_I2C_current_rx_transmission) free(_I2C_current_rx_transmission);
+	#ifdef I2C_FEATURE_LOW_POWER
+		//TWDR is not updated by an address match in power-down, TWAR is the only address that can match then
+		if (_I2C_woken) return TWAR >> 1;
+	#endif
 	
-	_I2C_current_rx_transmission = calloc(sizeof(I2CSlaveTransmission), 1);
-	_I2C_current_rx_transmission -> stream.buffer = calloc(1, 8);
-	_I2C_current_rx_transmission -> stream.length = 8;
-	_I2C_current_rx_transmission -> bytes_transmitted = 0;
+	return TWDR >> 1;
 }
 
-void _I2C_status_SR_DATA_ACK()
+I2CSlaveDevice* _I2C_find_device(uint8_t address)
 {
-	if (_I2C_current_rx_transmission == NULL) return;
+	for (uint8_t i = 0; i < _I2C_device_count; i++) if (_I2C_devices[i] -> address == address) return _I2C_devices[i];
 	
-	_I2C_current_rx_transmission -> bytes_transmitted++;
-	_I2C_write_to_stream(_I2C_current_rx_transmission, _I2C_current_rx_transmission -> bytes_transmitted, TWDR);
+	return NULL;
 }
 
-uint8_t _I2C_write_to_stream(I2CStream* stream, uint16_t new_length, uint8_t value)
+void _I2C_device_dispatch(enum I2CTransmissionStatus status)
 {
-	if(stream -> length > new_length)
+	I2CSlaveDevice* device = _I2C_current_device;
+	
+	switch(status)
 	{
-		stream -> length *= 2;	
-		stream -> buffer = realloc(stream -> buffer, stream -> length)
+		#ifdef I2C_FEATURE_SLAVE_RX
+		case SR_SLAW_ACK:
+		case SR_ARB_LOST_SLAW_ACK:
+			device = _I2C_find_device(_I2C_received_address());
+			_I2C_current_device = device;
+			
+			if (device) device -> bytes_received = 0;
+			
+			//Matched the mask but no device is registered (or rx_stream holds at most one byte), NACK the data
+			if (device == NULL || device -> rx_stream.length <= 1) TWCR &= ~TWCR_EA;
+			break;
+		
+		case SR_DATA_ACK:
+			if (device == NULL) break;
+			
+			if (device -> bytes_received < device -> rx_stream.length) device -> rx_stream.buffer[device -> bytes_received++] = TWDR;
+			
+			//Next byte is the last one that fits, NACK it so the master stops
+			if (device -> bytes_received + 1 >= device -> rx_stream.length) TWCR &= ~TWCR_EA;
+			break;
+		
+		case SR_DATA_NACK:
+			if (device && device -> bytes_received < device -> rx_stream.length) device -> rx_stream.buffer[device -> bytes_received++] = TWDR;
+			
+			//Not addressed anymore, STOP is not seen
+			if (device && device -> on_receive) device -> on_receive(device);
+			
+			//Return to not addressed mode with own address recognition
+			TWCR |= TWCR_EA;
+			_I2C_current_device = NULL;
+			I2C_transmission_ended = 1;
+			break;
+		
+		case SR_STOP_REPSTART:
+			if (device && device -> on_receive) device -> on_receive(device);
+			
+			//EA is still cleared when SLA+W was NACKed for data and no data followed (quick command)
+			TWCR |= TWCR_EA;
+			_I2C_current_device = NULL;
+			I2C_transmission_ended = 1;
+			break;
+		#endif
+		
+		#ifdef I2C_FEATURE_SLAVE_TX
+		case ST_SLAR_ACK:
+		case ST_ARB_LOST_SLAR_ACK:
+			device = _I2C_find_device(_I2C_received_address());
+			_I2C_current_device = device;
+			
+			if (device)
+			{
+				device -> bytes_sent = 0;
+				if (device -> on_request) device -> on_request(device);
+			}
+			//fall through
+		
+		case ST_DATA_ACK:
+			if (device && device -> bytes_sent < device -> tx_stream.length) TWDR = device -> tx_stream.buffer[device -> bytes_sent++];
+			else TWDR = 0xFF;
+			break;
+		
+		case ST_DATA_NACK:
+		case ST_DATA_DONE:
+			TWCR |= TWCR_EA;
+			_I2C_current_device = NULL;
+			I2C_transmission_ended = 1;
+			break;
+		#endif
+		
+		default:
+			break;
 	}
-	if(stream -> buffer == NULL) return 1;
-	
-	stream -> buffer[new_length - 1] = value;
-	return 0;
 }
+#endif
 
-uint8_t _I2C_trim_stream(I2CStream* stream)
+#ifdef I2C_BUFFERED_MODE
+//Passing whole stream because pointer can change in next ISR
+//The handler takes ownership of the buffer, without a handler it is freed
+void _I2C_on_receive_invoke()
 {
-	stream -> length = _I2C_current_rx_transmission -> bytes_transmitted;
-	stream -> buffer = realloc(stream -> buffer, stream -> length)
+	if(_I2C_on_receive_handler) _I2C_on_receive_handler(_I2C_current_rx_transmission -> stream);
+	else free(_I2C_current_rx_transmission -> stream.buffer);
 	
-	if (stream -> buffer == NULL) return 1;
-	return 0;
+	_I2C_current_rx_transmission -> stream.buffer = NULL;
+	_I2C_current_rx_transmission -> stream.length = 0;
 }
 
-enum I2CTransmissionResult _I2C_m_send(I2CMasterTransmission* transmission)
-{	
-	//START:
-	//Load start condition
-	TWCR |= TWCR_STA;
-	
-	//Clear the interrupt flag
-	TWCR |= TWCR_INT;
-	
-	//Wait for interrupt flag
-	while(!(TWCR & TWCR_INT));
-	
-	transmission -> status = TWSR & TWSR_STATUS;
-	if(!((TWSR & TWSR_STATUS) == MTR_START || (TWSR & TWSR_STATUS) == MTR_REPSTART))
-	{	
-		switch (TWSR & TWSR_STATUS)
-		{
-			case MTR_ARB_LOST:
-				return ARB_LOST;
-				
-			case SR_ARB_LOST_SLAW_ACK:
-				return ARB_LOST_SLA;
-				
-			case SR_ARB_LOST_GC_ACK:
-				return ARB_LOST_SLA;
-				
-			case ST_ARB_LOST_SLAR_ACK:
-				return ARB_LOST_SLA;
-				
-			default:
-				return UNEXPECTED_STATE;
-		}
+void _I2C_status_SR_SLAW_ACK()
+{
+	if(_I2C_current_rx_transmission)
+	{
+		free(_I2C_current_rx_transmission -> stream.buffer);
+		free(_I2C_current_rx_transmission);
 	}
 	
-	//SLA+W:
-	//Load SLA+W
-	TWDR = transmission -> slave_address << 1;
-	
-	//Clear the start flag
-	TWCR &= ~TWCR_STA;
-	
-	//Clear the interrupt flag
-	TWCR |= TWCR_INT;
+	_I2C_current_rx_transmission = calloc(sizeof(I2CSlaveTransmission), 1);
+	if (_I2C_current_rx_transmission == NULL) return;
 	
-	while(!(TWCR & TWCR_INT));
+	_I2C_current_rx_transmission -> stream.buffer = calloc(1, 8);
+	_I2C_current_rx_transmission -> stream.length = _I2C_current_rx_transmission -> stream.buffer? 8 : 0;
+	_I2C_current_rx_transmission -> bytes_transmitted = 0;
+}
+
+//General call is received the same way as own address
+void _I2C_status_SR_GC_ACK() {_I2C_status_SR_SLAW_ACK();}
+
+void _I2C_status_SR_DATA_ACK()
+{
+	if (_I2C_current_rx_transmission == NULL || _I2C_current_rx_transmission -> stream.buffer == NULL) return;
 	
-	transmission -> status = TWSR & TWSR_STATUS;
-	if ((TWSR & TWSR_STATUS) != MT_SLAW_ACK) return UNEXPECTED_STATE;
+	//Drop bytes that do not fit
+	if (_I2C_write_to_stream(&_I2C_current_rx_transmission -> stream, _I2C_current_rx_transmission -> bytes_transmitted + 1, TWDR)) return;
+	_I2C_current_rx_transmission -> bytes_transmitted++;
+}
+
+void _I2C_status_SR_GC_DATA_ACK() {_I2C_status_SR_DATA_ACK();}
+
+//Last byte, only reached when TWEA was cleared
+void _I2C_status_SR_DATA_NACK()
+{
+	_I2C_status_SR_DATA_ACK();
 	
-	//DATA
-	for(uint16_t i = 0; i < transmission -> stream.length; i++)
+	//Return to not addressed mode with own address recognition
+	TWCR |= TWCR_EA;
+	I2C_transmission_ended = 1;
+}
+
+void _I2C_status_SR_GC_DATA_NACK() {_I2C_status_SR_DATA_NACK();}
+
+void _I2C_status_SR_STOP_REPSTART()
+{
+	if (_I2C_current_rx_transmission && _I2C_current_rx_transmission -> stream.buffer)
 	{
-		TWDR = transmission -> stream.buffer[i];
-		TWCR |= TWCR_INT;
-		
-		while(!(TWCR & TWCR_INT));
-		
-		transmission -> status = TWSR & TWSR_STATUS;
-		if ((TWSR & TWSR_STATUS) != MT_DATA_ACK) return UNEXPECTED_STATE;
-		
-		transmission -> bytes_transmitted++;
+		_I2C_trim_stream(&_I2C_current_rx_transmission -> stream);
+		_I2C_on_receive_invoke();
 	}
 	
-	if(transmission -> config & TCONFIG_TERMINATOR)
-	{
-		TWDR = transmission -> terminator;
-		TWCR |= TWCR_INT;
-		
-		while(!(TWCR & TWCR_INT));
-		
-		transmission -> status = TWSR & TWSR_STATUS;
-		if ((TWSR & TWSR_STATUS) != MT_DATA_ACK) return UNEXPECTED_STATE;
-		
-		transmission -> bytes_transmitted++;
-	}
-	return SUCCESS;
+	I2C_transmission_ended = 1;
 }
 
-enum I2CTransmissionResult _I2C_m_request(I2CMasterTransmission* transmission)
+uint8_t _I2C_trim_stream(I2CStream* stream)
 {
-	//START:
-	//Load start condition
-	TWCR |= TWCR_STA;
-	
-	//Clear the interrupt flag
-	TWCR |= TWCR_INT;
-	
-	//Wait for interrupt flag
-	while(!(TWCR & TWCR_INT));
-	
-	transmission -> status = TWSR & TWSR_STATUS;
-	if(!((TWSR & TWSR_STATUS) == MTR_START || (TWSR & TWSR_STATUS) == MTR_REPSTART))
+	//realloc to 0 would free the buffer, keep it but report an empty write
+	if (_I2C_current_rx_transmission -> bytes_transmitted == 0)
 	{
-		switch (TWSR & TWSR_STATUS)
-		{
-			case MTR_ARB_LOST:
-				return ARB_LOST;
-			
-			case SR_ARB_LOST_SLAW_ACK:
-				return ARB_LOST_SLA;
-			
-			case SR_ARB_LOST_GC_ACK:
-				return ARB_LOST_SLA;
-			
-			case ST_ARB_LOST_SLAR_ACK:
-				return ARB_LOST_SLA;
-			
-			default:
-				return UNEXPECTED_STATE;
-		}
+		stream -> length = 0;
+		return 0;
 	}
 	
-	//SLA+R:
-	//Load SLA+R
-	TWDR = (transmission -> slave_address << 1) | 1;
+	char* buffer = realloc(stream -> buffer, _I2C_current_rx_transmission -> bytes_transmitted);
+	if (buffer == NULL) return 1;
 	
-	//Clear the start flag
-	TWCR &= ~TWCR_STA;
-	
-	//Clear the interrupt flag
-	TWCR |= TWCR_INT;
+	stream -> buffer = buffer;
+	stream -> length = _I2C_current_rx_transmission -> bytes_transmitted;
+	return 0;
+}
+#endif
+
+#ifdef I2C_FEATURE_MASTER
+//TWI backend, each primitive starts a bus action by clearing TWINT
+void _I2C_twi_start()
+{
+	//Load start condition and clear the interrupt flag
+	TWCR |= TWCR_STA | TWCR_INT;
+}
+
+void _I2C_twi_write(uint8_t value)
+{
+	TWDR = value;
 	
+	//Clear the start flag and the interrupt flag
+	TWCR = (TWCR & ~TWCR_STA) | TWCR_INT;
+}
+
+void _I2C_twi_read(uint8_t ack)
+{
+	TWCR = (TWCR & ~TWCR_EA) | (ack? TWCR_EA : 0) | TWCR_INT;
+}
+
+enum I2CTransmissionStatus _I2C_twi_wait()
+{
 	while(!(TWCR & TWCR_INT));
 	
-	transmission -> status = TWSR & TWSR_STATUS;
-	if (transmission -> status != MR_SLAR_ACK) return UNEXPECTED_STATE;
-	
-	//DATA:
-	if(transmission -> config & TCONFIG_TERMINATOR)
-	{
-		if (transmission -> stream.buffer == NULL)
-		{
-			transmission -> stream.buffer = calloc(1, 8);
-			transmission -> stream.length = 8;
-		}
-		
-		while(TWDR != transmission -> terminator)
-		{
-			TWCR |= TWCR_INT;
-			
-			while(!(TWCR & TWCR_INT));
-			
-			transmission -> status = TWSR & TWSR_STATUS;
-			
-			if (transmission -> status == MR_DATA_ACK)
-			{
-				transmission -> bytes_transmitted++;
-				if(_I2C_write_to_stream(transmission -> stream, transmission -> bytes_transmitted, TWDR)) return INTERNAL_ERROR;
-			}
-			else if(transmission -> status == MR_DATA_NACK)
-			{
-				transmission -> bytes_transmitted++;
-				if(_I2C_write_to_stream(transmission -> stream, transmission -> bytes_transmitted, TWDR)) return INTERNAL_ERROR;
-				return TERMINATOR_NOT_DETECTED;
-			}
-			else return UNEXPECTED_STATE;			
-		}
-	}
-	else
-	{
-		for(uint16_t i = 0; i < transmission -> stream.length; i++)
-		{
-			TWCR |= TWCR_INT;
-			
-			while(!(TWCR & TWCR_INT));
-			
-			transmission -> status = TWSR & TWSR_STATUS;
-			if (transmission -> status != MR_DATA_ACK) return UNEXPECTED_STATE;
-			
-			transmission -> stream.buffer[i] = TWDR;
-			transmission -> bytes_transmitted++;
-		}	
-	}
-	return SUCCESS;
-}
\ No newline at end of file
+	enum I2CTransmissionStatus status = TWSR & TWSR_STATUS;
+	_I2C_TRACE(status);
+	return status;
+}
+
+uint8_t _I2C_twi_data() {return TWDR;}
+#endif
+
+#endif
\ No newline at end of file
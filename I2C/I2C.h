@@ -5,18 +5,83 @@
 #include <avr/interrupt.h>
 #include <stdlib.h>
 
-#define F_CPU 16000000
+#ifndef F_CPU
+	#define F_CPU 16000000
+#endif
+
+//Feature slices
+//Define I2C_MINIMAL and then only the I2C_FEATURE_* slices that are needed
+//I2C_FEATURE_STATS, I2C_FEATURE_TRACE and I2C_FEATURE_LOW_POWER are always opt-in
+#ifndef I2C_MINIMAL
+	#define I2C_FEATURE_MASTER
+	#define I2C_FEATURE_SLAVE_RX
+	#define I2C_FEATURE_SLAVE_TX
+	#define I2C_FEATURE_TERMINATOR
+	#define I2C_FEATURE_MULTI_MASTER
+#endif
+
+//Parts without TWI (e.g. ATtiny with USI) only have the master protocol of I2CProtocol.c for I2CSoft
+//I2C.c is empty there, the slices that need the TWI are dropped
+#ifdef TWCR
+	#define I2C_FEATURE_TWI
+#else
+	#undef I2C_FEATURE_SLAVE_RX
+	#undef I2C_FEATURE_SLAVE_TX
+	#undef I2C_FEATURE_STATS
+	#undef I2C_FEATURE_TRACE
+#endif
+
+#if defined(I2C_FEATURE_SLAVE_RX) || defined(I2C_FEATURE_SLAVE_TX)
+	#define I2C_FEATURE_SLAVE
+#endif
+
+//Power-down between slave transactions (see I2C_sleep_until_address), needs a slave slice
+#if defined(I2C_FEATURE_LOW_POWER) && !defined(I2C_FEATURE_SLAVE)
+	#undef I2C_FEATURE_LOW_POWER
+#endif
+
+//Trace ring buffer, I2C_TRACE_SIZE must be a power of 2
+//I2C_TRACE_TICK is sampled for every entry, TIMER1 has to be started by the application
+#ifdef I2C_FEATURE_TRACE
+	#ifndef I2C_TRACE_SIZE
+		#define I2C_TRACE_SIZE 32
+	#endif
+	#ifndef I2C_TRACE_TICK
+		#define I2C_TRACE_TICK TCNT1
+	#endif
+#endif
+
+//Define I2C_FREQUENCY to compute TWBR at compile time, I2CConfig.frequency is then ignored
+
+//Compile-time bit rate register values for SCL frequency
+//SCL frequency = CPU clock frequency / (16 + 2 * TWBR * 4^TWPS)
+#define I2C_TWBRP(frequency) ((F_CPU / (2UL * (frequency))) - 8)
+#define I2C_TWPS(frequency) (I2C_TWBRP(frequency) <= 255? 0 : I2C_TWBRP(frequency) / 4 <= 255? 1 : I2C_TWBRP(frequency) / 16 <= 255? 2 : 3)
+#define I2C_TWBR(frequency) (I2C_TWBRP(frequency) >> (2 * I2C_TWPS(frequency)))
+
+//Entry of the per-device speed table, see I2C_set_device_timings
+#define I2C_DEVICE_TIMING(address, frequency) {.slave_address = (address), .twbr = I2C_TWBR(frequency), .twps = I2C_TWPS(frequency)}
 
-#ifndef I2C_STREAM_MODE
+//Heap-backed slave receive path, needs I2C_FEATURE_SLAVE_RX
+#if !defined(I2C_STREAM_MODE) && defined(I2C_FEATURE_SLAVE_RX)
 	#define I2C_BUFFERED_MODE
 #endif
 
+//Maximum number of emulated slave devices (see I2C_slave_register)
+#ifndef I2C_SLAVE_DEVICES_MAX
+	#define I2C_SLAVE_DEVICES_MAX 4
+#endif
+
 //transmission config
 #define TCONFIG_MODE 0x01
 #define TCONFIG_TERMINATOR 0x02
+#define TCONFIG_PEC 0x04
+#define TCONFIG_LENGTH_PREFIX 0x08
 
 #define TCONFIG_MODE_READ 0x01
 #define TCONFIG_ENABLE_TERMINATOR 0x02
+#define TCONFIG_ENABLE_PEC 0x04 //SMBus Packet Error Checking (CRC-8), appended on write, verified on read
+#define TCONFIG_ENABLE_LENGTH_PREFIX 0x08 //Read only: first received byte is the number of data bytes that follow
 
 enum I2CMode{
 	MASTER = 0,
@@ -31,7 +96,10 @@ enum I2CTransmissionResult{
 	ARB_LOST_SLA = 3,
 	UNEXPECTED_STATE = 4,
 	INTERNAL_ERROR = 5,
-	TERMINATOR_NOT_DETECTED = 6
+	TERMINATOR_NOT_DETECTED = 6,
+	PEC_MISMATCH = 7,
+	LENGTH_OVERFLOW = 8,
+	BUS_TIMEOUT = 9
 };
 
 enum I2CTransmissionStatus{
@@ -66,7 +134,7 @@ enum I2CTransmissionStatus{
 	SR_DATA_ACK = 0x80, //Previously addressed with own SLA+W; data has been received; ACK has been returned
 	SR_DATA_NACK = 0x88, //Previously addressed with own SLA+W; data has been received; NOT ACK has been returned
 	SR_GC_DATA_ACK = 0x90, //Previously addressed with general call; data has been received; ACK has been returned
-	SR_GC_DATA_NACK = 0x90, //Previously addressed with general call; data has been received; NOT ACK has been returned
+	SR_GC_DATA_NACK = 0x98, //Previously addressed with general call; data has been received; NOT ACK has been returned
 	SR_STOP_REPSTART = 0xA0, //A STOP condition or repeated START condition has been received while still addressed as slave
 	
 	ST_SLAR_ACK = 0xA8, //Own SLA+R has been received; ACK has been returned
@@ -77,21 +145,36 @@ enum I2CTransmissionStatus{
 	
 	M_NO_INFO = 0xF8, //No relevant state information available; TWINT = 0
 	M_ERR_ILLEGAL_START_STOP = 0x00, //Bus error due to an illegal START or STOP condition
+	
+	C_BUS_TIMEOUT = 0xF0, //Software backend: SCL held low by a slave for longer than the timeout
 };
 
+typedef struct I2CStream{
+	char* buffer;
+	uint16_t length;
+} I2CStream;
+
 typedef struct I2CConfig{
 	uint32_t frequency;
 	uint8_t address;
+	uint8_t address_mask; //Loaded into TWAMR, set bits are ignored in address match
 	enum I2CMode mode;
 	uint8_t recognize_general_call;
 } I2CConfig;
 
+typedef struct I2CDeviceTiming{
+	uint8_t slave_address;
+	uint8_t twbr;
+	uint8_t twps;
+} I2CDeviceTiming;
+
 typedef struct I2CMasterTransmission{
 	I2CStream stream;
 	uint8_t slave_address;
 	uint8_t config;
 	uint8_t terminator;
 	uint16_t bytes_transmitted;
+	uint8_t pec; //PEC of the last transmission
 	enum I2CTransmissionStatus status;
 } I2CMasterTransmission;
 
@@ -101,20 +184,99 @@ typedef struct I2CSlaveTransmission{
 	enum I2CTransmissionStatus status;
 }I2CSlaveTransmission;
 
-typedef struct I2CStream{
-	char* buffer;
-	uint16_t length;
-} I2CStream;
+//Emulated slave device, matched through TWAMR address masking
+//rx_stream and tx_stream are fixed buffers owned by the caller, the last byte that fits into rx_stream is NACKed
+typedef struct I2CSlaveDevice{
+	uint8_t address;
+	I2CStream rx_stream;
+	I2CStream tx_stream;
+	uint16_t bytes_received;
+	uint16_t bytes_sent;
+	void (*on_receive)(struct I2CSlaveDevice* device); //Called on STOP/repeated START after a write, or after the last byte that fits into rx_stream
+	void (*on_request)(struct I2CSlaveDevice* device); //Called on SLA+R, before the first byte is sent
+} I2CSlaveDevice;
+
+#ifdef I2C_FEATURE_STATS
+typedef struct I2CStats{
+	uint16_t transmissions;
+	uint16_t errors;
+	uint16_t nacks;
+	uint16_t arbitration_lost;
+} I2CStats;
+
+extern I2CStats I2C_stats;
+#endif
+
+#ifdef I2C_FEATURE_TRACE
+typedef struct I2CTraceEntry{
+	uint8_t status; //TWSR & TWSR_STATUS
+	uint8_t data; //TWDR
+	uint16_t tick; //I2C_TRACE_TICK
+} I2CTraceEntry;
+#endif
+
+#ifdef I2C_FEATURE_TWI
+	extern volatile uint8_t I2C_transmission_ended;
+	
+	uint8_t I2C_init(I2CConfig* config);
+	void I2C_enable();
+	void I2C_disable();
+#endif
+
+#ifdef I2C_FEATURE_MASTER
+//Bus primitives of a master backend, the transmission protocol on top of them is shared (see I2CSoft.h)
+//start, write and read begin a bus action, wait returns its status once it is done
+typedef struct I2CMasterBackend{
+	void (*start)(); //START or repeated START
+	void (*write)(uint8_t value); //SLA+R/W or data byte
+	void (*read)(uint8_t ack); //ack: answer the received byte with ACK
+	enum I2CTransmissionStatus (*wait)();
+	uint8_t (*data)(); //Last received byte
+} I2CMasterBackend;
+#endif
+
+#if defined(I2C_FEATURE_MASTER) && defined(I2C_FEATURE_TWI)
+	enum I2CTransmissionResult I2C_start_transmission(I2CMasterTransmission* transmission);
+	enum I2CTransmissionResult I2C_start_combined_transmission(I2CMasterTransmission* write, I2CMasterTransmission* read);
+	void I2C_set_device_timings(const I2CDeviceTiming* timings, uint8_t count);
+	I2CDeviceTiming I2C_get_device_timing(uint8_t slave_address);
+#endif
+
+#ifdef I2C_FEATURE_MASTER
+	//Shared master protocol for backends (I2CProtocol.c), the caller ends the transmission with STOP
+	enum I2CTransmissionResult _I2C_m_transmission(const I2CMasterBackend* backend, I2CMasterTransmission* transmission);
+	enum I2CTransmissionResult _I2C_m_combined(const I2CMasterBackend* backend, I2CMasterTransmission* write, I2CMasterTransmission* read);
+#endif
 
-volatile uint8_t I2C_transmission_ended;
+#if defined(I2C_BUFFERED_MODE) || defined(I2C_FEATURE_TERMINATOR)
+	//Grows the stream (doubling, at least 8 bytes) so that value is stored at new_length - 1
+	//Returns 1 if realloc failed, the old buffer is kept
+	uint8_t _I2C_write_to_stream(I2CStream* stream, uint16_t new_length, uint8_t value);
+#endif
 
-uint8_t I2C_init();
-void I2C_enable();
-void I2C_disable();
-void I2C_enable_GC_recognition();
-void I2C_disable_GC_recognition();
-enum I2CTransmissionResult I2C_start_transmission(I2CMasterTransmission* transmission);
-void I2C_on_receive_subscribe(void* handler);
-void I2C_on_receive_unsubscribe();
+#ifdef I2C_FEATURE_SLAVE
+	void I2C_enable_GC_recognition();
+	void I2C_disable_GC_recognition();
+	uint8_t I2C_slave_register(I2CSlaveDevice* device);
+	void I2C_slave_unregister(I2CSlaveDevice* device);
+#endif
+
+#ifdef I2C_FEATURE_LOW_POWER
+	uint8_t I2C_sleep_until_address();
+#endif
+
+#ifdef I2C_BUFFERED_MODE
+	void I2C_on_receive_subscribe(void* handler);
+	void I2C_on_receive_unsubscribe();
+#endif
+
+#ifdef I2C_FEATURE_STATS
+	void I2C_stats_reset();
+#endif
+
+#ifdef I2C_FEATURE_TRACE
+	uint8_t I2C_trace_dump(I2CTraceEntry* entries, uint8_t max);
+	void I2C_trace_clear();
+#endif
 
 #endif
\ No newline at end of file
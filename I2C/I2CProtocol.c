@@ -0,0 +1,287 @@
+#include "I2C.h"
+#include <avr/pgmspace.h>
+
+//TWI-independent part of the library: master protocol, PEC and stream helpers
+//Also built for parts without TWI, I2C.c is empty there (see I2CSoft.h)
+
+#ifdef I2C_FEATURE_MASTER
+//SMBus PEC: CRC-8, polynomial x^8 + x^2 + x + 1 (0x07), processed one nibble at a time
+const uint8_t _I2C_pec_table[16] PROGMEM = {
+	0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+	0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D
+};
+
+static inline uint8_t _I2C_pec_update(uint8_t pec, uint8_t data)
+{
+	pec ^= data;
+	pec = (pec << 4) ^ pgm_read_byte(&_I2C_pec_table[pec >> 4]);
+	pec = (pec << 4) ^ pgm_read_byte(&_I2C_pec_table[pec >> 4]);
+	return pec;
+}
+
+enum I2CTransmissionResult _I2C_m_check(I2CMasterTransmission* transmission, enum I2CTransmissionStatus status, enum I2CTransmissionStatus expected);
+enum I2CTransmissionResult _I2C_m_start(const I2CMasterBackend* backend, I2CMasterTransmission* transmission);
+enum I2CTransmissionResult _I2C_m_write(const I2CMasterBackend* backend, I2CMasterTransmission* transmission, uint8_t value, uint8_t* pec, enum I2CTransmissionStatus expected);
+enum I2CTransmissionResult _I2C_m_send(const I2CMasterBackend* backend, I2CMasterTransmission* transmission, uint8_t pec, uint8_t last);
+enum I2CTransmissionResult _I2C_m_request(const I2CMasterBackend* backend, I2CMasterTransmission* transmission, uint8_t pec);
+enum I2CTransmissionResult _I2C_m_request_data(const I2CMasterBackend* backend, I2CMasterTransmission* transmission, uint8_t pec);
+enum I2CTransmissionResult _I2C_m_read(const I2CMasterBackend* backend, I2CMasterTransmission* transmission, uint8_t ack, uint8_t* pec, uint8_t* pending);
+enum I2CTransmissionResult _I2C_m_receive(const I2CMasterBackend* backend, I2CMasterTransmission* transmission, uint16_t length, uint8_t* pec, uint8_t* pending);
+#endif
+
+#if defined(I2C_BUFFERED_MODE) || defined(I2C_FEATURE_TERMINATOR)
+uint8_t _I2C_write_to_stream(I2CStream* stream, uint16_t new_length, uint8_t value)
+{
+	if(new_length > stream -> length)
+	{
+		uint16_t length = stream -> length? stream -> length : 8;
+		while (length < new_length) length *= 2;
+		
+		//Keep the old buffer if realloc fails
+		char* buffer = realloc(stream -> buffer, length);
+		if(buffer == NULL) return 1;
+		
+		stream -> buffer = buffer;
+		stream -> length = length;
+	}
+	
+	stream -> buffer[new_length - 1] = value;
+	return 0;
+}
+#endif
+
+#ifdef I2C_FEATURE_MASTER
+//Shared master protocol (modes, PEC), backends only provide the bus primitives
+enum I2CTransmissionResult _I2C_m_transmission(const I2CMasterBackend* backend, I2CMasterTransmission* transmission)
+{
+	if (transmission -> config & TCONFIG_MODE) return _I2C_m_request(backend, transmission, 0);
+	return _I2C_m_send(backend, transmission, 0, 1);
+}
+
+//Write phase, repeated START, read phase
+//PEC (if enabled on read) covers both phases
+enum I2CTransmissionResult _I2C_m_combined(const I2CMasterBackend* backend, I2CMasterTransmission* write, I2CMasterTransmission* read)
+{
+	//PEC byte is only appended at the very end
+	enum I2CTransmissionResult result = _I2C_m_send(backend, write, 0, 0);
+	if (result == SUCCESS) result = _I2C_m_request(backend, read, write -> pec);
+	
+	return result;
+}
+
+//Stores status, only expected continues the transmission
+enum I2CTransmissionResult _I2C_m_check(I2CMasterTransmission* transmission, enum I2CTransmissionStatus status, enum I2CTransmissionStatus expected)
+{
+	transmission -> status = status;
+	
+	if (status == expected) return SUCCESS;
+	
+	switch (status)
+	{
+		case C_BUS_TIMEOUT:
+			return BUS_TIMEOUT;
+		
+		#ifdef I2C_FEATURE_MULTI_MASTER
+		//Another master won the bus, it may be addressing this device
+		case MTR_ARB_LOST:
+			return ARB_LOST;
+		
+		case SR_ARB_LOST_SLAW_ACK:
+		case SR_ARB_LOST_GC_ACK:
+		case ST_ARB_LOST_SLAR_ACK:
+			return ARB_LOST_SLA;
+		#endif
+		
+		default:
+			return UNEXPECTED_STATE;
+	}
+}
+
+enum I2CTransmissionResult _I2C_m_start(const I2CMasterBackend* backend, I2CMasterTransmission* transmission)
+{
+	//START:
+	backend -> start();
+	
+	enum I2CTransmissionStatus status = backend -> wait();
+	
+	return _I2C_m_check(transmission, status, status == MTR_REPSTART? MTR_REPSTART : MTR_START);
+}
+
+//Sends value and folds it into the PEC while it is being shifted out
+enum I2CTransmissionResult _I2C_m_write(const I2CMasterBackend* backend, I2CMasterTransmission* transmission, uint8_t value, uint8_t* pec, enum I2CTransmissionStatus expected)
+{
+	backend -> write(value);
+	*pec = _I2C_pec_update(*pec, value);
+	
+	return _I2C_m_check(transmission, backend -> wait(), expected);
+}
+
+//pec: PEC of the preceding phase of the transaction (0 if none)
+//last: the write ends the transaction, only then the PEC byte (if enabled) is appended
+enum I2CTransmissionResult _I2C_m_send(const I2CMasterBackend* backend, I2CMasterTransmission* transmission, uint8_t pec, uint8_t last)
+{	
+	enum I2CTransmissionResult result = _I2C_m_start(backend, transmission);
+	if (result != SUCCESS) return result;
+	
+	//SLA+W:
+	result = _I2C_m_write(backend, transmission, transmission -> slave_address << 1, &pec, MT_SLAW_ACK);
+	if (result != SUCCESS) return result;
+	
+	//DATA
+	for(uint16_t i = 0; i < transmission -> stream.length; i++)
+	{
+		result = _I2C_m_write(backend, transmission, transmission -> stream.buffer[i], &pec, MT_DATA_ACK);
+		if (result != SUCCESS) return result;
+		
+		transmission -> bytes_transmitted++;
+	}
+	
+	#ifdef I2C_FEATURE_TERMINATOR
+	if(transmission -> config & TCONFIG_TERMINATOR)
+	{
+		//Not part of the stream, bytes_transmitted stays within stream.length
+		result = _I2C_m_write(backend, transmission, transmission -> terminator, &pec, MT_DATA_ACK);
+		if (result != SUCCESS) return result;
+	}
+	#endif
+	
+	transmission -> pec = pec;
+	
+	if(last && (transmission -> config & TCONFIG_PEC))
+	{
+		backend -> write(pec);
+		return _I2C_m_check(transmission, backend -> wait(), MT_DATA_ACK);
+	}
+	return SUCCESS;
+}
+
+//PEC runs one byte behind on reads: pending (the previous byte) is folded in while the next byte is being shifted in
+//pending: previous byte in, received byte out
+enum I2CTransmissionResult _I2C_m_read(const I2CMasterBackend* backend, I2CMasterTransmission* transmission, uint8_t ack, uint8_t* pec, uint8_t* pending)
+{
+	backend -> read(ack);
+	*pec = _I2C_pec_update(*pec, *pending);
+	
+	enum I2CTransmissionResult result = _I2C_m_check(transmission, backend -> wait(), ack? MR_DATA_ACK : MR_DATA_NACK);
+	*pending = backend -> data();
+	
+	return result;
+}
+
+//Receives length bytes into the stream, the last one is answered with NACK unless PEC follows
+enum I2CTransmissionResult _I2C_m_receive(const I2CMasterBackend* backend, I2CMasterTransmission* transmission, uint16_t length, uint8_t* pec, uint8_t* pending)
+{
+	for(uint16_t i = 0; i < length; i++)
+	{
+		uint8_t last = i == length - 1 && !(transmission -> config & TCONFIG_PEC);
+		
+		enum I2CTransmissionResult result = _I2C_m_read(backend, transmission, !last, pec, pending);
+		if (result != SUCCESS) return result;
+		
+		transmission -> stream.buffer[i] = *pending;
+		transmission -> bytes_transmitted++;
+	}
+	
+	return SUCCESS;
+}
+
+//pec: PEC of the preceding phase of the transaction (0 if none)
+enum I2CTransmissionResult _I2C_m_request(const I2CMasterBackend* backend, I2CMasterTransmission* transmission, uint8_t pec)
+{
+	enum I2CTransmissionResult result = _I2C_m_request_data(backend, transmission, pec);
+	
+	//STOP is not allowed after SLA+R or a data byte was ACKed (0x40/0x50), the slave is still driving SDA
+	//Read a dummy byte with NACK so it releases the bus (zero length, length prefix 0, terminator found)
+	if (transmission -> status == MR_SLAR_ACK || transmission -> status == MR_DATA_ACK)
+	{
+		backend -> read(0);
+		
+		//Lost arbitration overrides the result, _I2C_m_end must not send STOP then
+		enum I2CTransmissionResult released = _I2C_m_check(transmission, backend -> wait(), MR_DATA_NACK);
+		if (result == SUCCESS || released == ARB_LOST) result = released;
+	}
+	
+	return result;
+}
+
+enum I2CTransmissionResult _I2C_m_request_data(const I2CMasterBackend* backend, I2CMasterTransmission* transmission, uint8_t pec)
+{
+	enum I2CTransmissionResult result = _I2C_m_start(backend, transmission);
+	if (result != SUCCESS) return result;
+	
+	//SLA+R:
+	uint8_t pending = (transmission -> slave_address << 1) | 1;
+	backend -> write(pending);
+	
+	result = _I2C_m_check(transmission, backend -> wait(), MR_SLAR_ACK);
+	if (result != SUCCESS) return result;
+	
+	//DATA:
+	#ifdef I2C_FEATURE_TERMINATOR
+	if(transmission -> config & TCONFIG_TERMINATOR)
+	{
+		if (transmission -> stream.buffer == NULL)
+		{
+			transmission -> stream.buffer = calloc(1, 8);
+			transmission -> stream.length = 8;
+		}
+		
+		do
+		{
+			backend -> read(1);
+			pec = _I2C_pec_update(pec, pending);
+			
+			transmission -> status = backend -> wait();
+			pending = backend -> data();
+			
+			if (transmission -> status == MR_DATA_ACK)
+			{
+				transmission -> bytes_transmitted++;
+				if(_I2C_write_to_stream(&transmission -> stream, transmission -> bytes_transmitted, pending)) return INTERNAL_ERROR;
+			}
+			else if(transmission -> status == MR_DATA_NACK)
+			{
+				transmission -> bytes_transmitted++;
+				if(_I2C_write_to_stream(&transmission -> stream, transmission -> bytes_transmitted, pending)) return INTERNAL_ERROR;
+				return TERMINATOR_NOT_DETECTED;
+			}
+			else return _I2C_m_check(transmission, transmission -> status, MR_DATA_ACK);
+		}
+		while(pending != transmission -> terminator);
+	}
+	else
+	#endif
+	if(transmission -> config & TCONFIG_LENGTH_PREFIX)
+	{
+		//First byte is the number of data bytes that follow
+		result = _I2C_m_read(backend, transmission, 1, &pec, &pending);
+		if (result != SUCCESS) return result;
+		
+		uint8_t length = pending;
+		
+		//The slave is released by _I2C_m_request
+		if (length > transmission -> stream.length) return LENGTH_OVERFLOW;
+		
+		result = _I2C_m_receive(backend, transmission, length, &pec, &pending);
+		if (result != SUCCESS) return result;
+	}
+	else
+	{
+		result = _I2C_m_receive(backend, transmission, transmission -> stream.length, &pec, &pending);
+		if (result != SUCCESS) return result;
+	}
+	
+	if(transmission -> config & TCONFIG_PEC)
+	{
+		//PEC is the last byte, answer with NACK (TWI restores ACK with STOP)
+		result = _I2C_m_read(backend, transmission, 0, &pec, &pending);
+		transmission -> pec = pec;
+		
+		if (result != SUCCESS) return result;
+		if (pending != pec) return PEC_MISMATCH;
+	}
+	else transmission -> pec = _I2C_pec_update(pec, pending);
+	
+	return SUCCESS;
+}
+#endif
\ No newline at end of file
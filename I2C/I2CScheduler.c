@@ -0,0 +1,132 @@
+#include "I2CScheduler.h"
+
+I2CJob* _I2C_scheduler_next(uint16_t now);
+void _I2C_scheduler_execute(I2CJob* job);
+
+I2CJob* _I2C_jobs[I2C_SCHEDULER_JOBS_MAX];
+uint8_t _I2C_job_count;
+volatile uint16_t _I2C_scheduler_ticks;
+
+//offset: ticks until the first release, lets jobs with equal periods be spread over the bus
+//Return codes:
+//0: Success
+//1: Job table full
+//2: Invalid job (period and deadline must be 1 - 0x7FFF, times are compared as signed differences)
+uint8_t I2C_scheduler_add(I2CJob* job, uint16_t offset)
+{
+	if (job == NULL || job -> transmission == NULL || job -> period == 0) return 2;
+	if (job -> period > 0x7FFF || job -> deadline > 0x7FFF) return 2;
+	if (_I2C_job_count >= I2C_SCHEDULER_JOBS_MAX) return 1;
+	
+	if (job -> deadline == 0) job -> deadline = job -> period;
+	
+	job -> release = I2C_scheduler_now() + offset;
+	job -> latency = 0;
+	job -> max_latency = 0;
+	job -> deadline_misses = 0;
+	job -> runs = 0;
+	job -> result = SUCCESS;
+	
+	_I2C_jobs[_I2C_job_count++] = job;
+	
+	return 0;
+}
+
+void I2C_scheduler_remove(I2CJob* job)
+{
+	for (uint8_t i = 0; i < _I2C_job_count; i++)
+	{
+		if (_I2C_jobs[i] != job) continue;
+		
+		_I2C_jobs[i] = _I2C_jobs[--_I2C_job_count];
+		return;
+	}
+}
+
+//Call from a periodic timer interrupt, the tick period is the time unit of all jobs
+void I2C_scheduler_tick() {_I2C_scheduler_ticks++;}
+
+uint16_t I2C_scheduler_now()
+{
+	//16 bit read is not atomic on AVR
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t ticks = _I2C_scheduler_ticks;
+	SREG = sreg;
+	
+	return ticks;
+}
+
+//Runs all jobs released up to the call back to back, earliest deadline first
+//Jobs released while running wait for the next call, so an overloaded bus can not starve the main loop
+//Call from the main loop
+//Returns number of jobs run
+uint8_t I2C_scheduler_run()
+{
+	uint16_t now = I2C_scheduler_now();
+	uint8_t count = 0;
+	I2CJob* job;
+	
+	while ((job = _I2C_scheduler_next(now)) != NULL)
+	{
+		_I2C_scheduler_execute(job);
+		count++;
+	}
+	
+	return count;
+}
+
+//Job released at or before now with the earliest absolute deadline, NULL if none is due
+I2CJob* _I2C_scheduler_next(uint16_t now)
+{
+	I2CJob* next = NULL;
+	int16_t next_slack = 0;
+	
+	for (uint8_t i = 0; i < _I2C_job_count; i++)
+	{
+		I2CJob* job = _I2C_jobs[i];
+		
+		//Signed difference keeps working across tick overflow
+		if ((int16_t)(now - job -> release) < 0) continue;
+		
+		int16_t slack = (int16_t)(job -> release + job -> deadline - now);
+		
+		if (next == NULL || slack < next_slack)
+		{
+			next = job;
+			next_slack = slack;
+		}
+	}
+	
+	return next;
+}
+
+void _I2C_scheduler_execute(I2CJob* job)
+{
+	job -> transmission -> bytes_transmitted = 0;
+	
+	if (job -> command)
+	{
+		job -> command -> bytes_transmitted = 0;
+		job -> result = I2C_start_combined_transmission(job -> command, job -> transmission);
+	}
+	else job -> result = I2C_start_transmission(job -> transmission);
+	
+	uint16_t now = I2C_scheduler_now();
+	
+	job -> latency = now - job -> release;
+	if (job -> latency > job -> max_latency) job -> max_latency = job -> latency;
+	if (job -> latency > job -> deadline) job -> deadline_misses++;
+	job -> runs++;
+	
+	job -> release += job -> period;
+	
+	//Fell behind by whole periods, skip them instead of bursting
+	while ((int16_t)(now - job -> release) >= (int16_t)job -> period)
+	{
+		job -> release += job -> period;
+		job -> deadline_misses++;
+	}
+	
+	if (job -> on_complete) job -> on_complete(job);
+}
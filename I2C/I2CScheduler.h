@@ -0,0 +1,33 @@
+#ifndef I2CSCHEDULER_H_
+#define I2CSCHEDULER_H_
+
+#include "I2C.h"
+
+#ifndef I2C_SCHEDULER_JOBS_MAX
+	#define I2C_SCHEDULER_JOBS_MAX 16
+#endif
+
+//Periodic bus job, all times are in scheduler ticks (see I2C_scheduler_tick)
+typedef struct I2CJob{
+	I2CMasterTransmission* command; //Optional write phase (e.g. register address), sent with repeated START before transmission
+	I2CMasterTransmission* transmission;
+	uint16_t period;
+	uint16_t deadline; //Relative to release, 0 = period
+	void (*on_complete)(struct I2CJob* job); //Called after every run, from I2C_scheduler_run
+	
+	//Managed by the scheduler
+	uint16_t release;
+	uint16_t latency; //Release to completion of the last run
+	uint16_t max_latency;
+	uint16_t deadline_misses;
+	uint16_t runs;
+	enum I2CTransmissionResult result;
+} I2CJob;
+
+uint8_t I2C_scheduler_add(I2CJob* job, uint16_t offset);
+void I2C_scheduler_remove(I2CJob* job);
+void I2C_scheduler_tick();
+uint8_t I2C_scheduler_run();
+uint16_t I2C_scheduler_now();
+
+#endif
@@ -0,0 +1,223 @@
+#include "I2CSoft.h"
+
+#define _I2C_SOFT_HALF_CYCLES (F_CPU / (2UL * I2C_SOFT_FREQUENCY))
+
+//Input synchronizer (1 cycle) and SCL rise time before the level is sampled
+#define _I2C_SOFT_SETTLE_CYCLES (1 + F_CPU / 1000000UL * I2C_SOFT_RISE_TIME_NS / 1000)
+
+#if _I2C_SOFT_HALF_CYCLES > I2C_SOFT_OVERHEAD
+	#define _I2C_SOFT_DELAY() __builtin_avr_delay_cycles(_I2C_SOFT_HALF_CYCLES - I2C_SOFT_OVERHEAD)
+#else
+	#define _I2C_SOFT_DELAY()
+#endif
+
+//SCL high half bit, the settle time after releasing SCL is already part of it
+#if _I2C_SOFT_HALF_CYCLES > I2C_SOFT_OVERHEAD + _I2C_SOFT_SETTLE_CYCLES
+	#define _I2C_SOFT_HIGH_DELAY() __builtin_avr_delay_cycles(_I2C_SOFT_HALF_CYCLES - I2C_SOFT_OVERHEAD - _I2C_SOFT_SETTLE_CYCLES)
+#else
+	#define _I2C_SOFT_HIGH_DELAY()
+#endif
+
+//Open-drain emulation: low = output (PORT bit is 0), high = input with external pull-up
+#define _I2C_SOFT_SDA_LOW() (I2C_SOFT_DDR |= (1 << I2C_SOFT_SDA))
+#define _I2C_SOFT_SDA_RELEASE() (I2C_SOFT_DDR &= ~(1 << I2C_SOFT_SDA))
+#define _I2C_SOFT_SCL_LOW() (I2C_SOFT_DDR |= (1 << I2C_SOFT_SCL))
+#define _I2C_SOFT_SCL_RELEASE() (I2C_SOFT_DDR &= ~(1 << I2C_SOFT_SCL))
+#define _I2C_SOFT_SDA_READ() (I2C_SOFT_PIN & (1 << I2C_SOFT_SDA))
+#define _I2C_SOFT_SCL_READ() (I2C_SOFT_PIN & (1 << I2C_SOFT_SCL))
+
+uint8_t _I2CSoft_scl_release();
+uint8_t _I2CSoft_start();
+void _I2CSoft_stop();
+uint8_t _I2CSoft_write_byte(uint8_t value);
+uint8_t _I2CSoft_read_byte(uint8_t ack);
+enum I2CTransmissionResult _I2CSoft_end(enum I2CTransmissionResult result);
+
+//Backend primitives, the bus action is already done when wait is called
+void _I2CSoft_backend_start();
+void _I2CSoft_backend_write(uint8_t value);
+void _I2CSoft_backend_read(uint8_t ack);
+enum I2CTransmissionStatus _I2CSoft_backend_wait();
+uint8_t _I2CSoft_backend_data();
+
+const I2CMasterBackend _I2CSoft_backend = {_I2CSoft_backend_start, _I2CSoft_backend_write, _I2CSoft_backend_read, _I2CSoft_backend_wait, _I2CSoft_backend_data};
+
+uint16_t I2CSoft_stretch_count;
+uint8_t _I2CSoft_timeout;
+uint8_t _I2CSoft_active; //START was sent, next START is a repeated START
+uint8_t _I2CSoft_addressing; //Next write is SLA+R/W
+enum I2CTransmissionStatus _I2CSoft_status;
+uint8_t _I2CSoft_data;
+
+void I2CSoft_init()
+{
+	//PORT bits stay 0, lines are driven only through DDR
+	I2C_SOFT_PORT &= ~((1 << I2C_SOFT_SDA) | (1 << I2C_SOFT_SCL));
+	_I2C_SOFT_SDA_RELEASE();
+	_I2C_SOFT_SCL_RELEASE();
+}
+
+enum I2CTransmissionResult I2CSoft_start_transmission(I2CMasterTransmission* transmission)
+{
+	if (transmission == NULL || transmission -> stream.buffer == NULL) return INTERNAL_ERROR;
+	
+	return _I2CSoft_end(_I2C_m_transmission(&_I2CSoft_backend, transmission));
+}
+
+enum I2CTransmissionResult I2CSoft_start_combined_transmission(I2CMasterTransmission* write, I2CMasterTransmission* read)
+{
+	if (write == NULL || write -> stream.buffer == NULL) return INTERNAL_ERROR;
+	if (read == NULL || read -> stream.buffer == NULL) return INTERNAL_ERROR;
+	
+	return _I2CSoft_end(_I2C_m_combined(&_I2CSoft_backend, write, read));
+}
+
+enum I2CTransmissionResult _I2CSoft_end(enum I2CTransmissionResult result)
+{
+	//The bus belongs to the other master
+	if (result != ARB_LOST) _I2CSoft_stop();
+	
+	_I2CSoft_active = 0;
+	return result;
+}
+
+//Returns 1 if the slave stretched SCL longer than I2C_SOFT_STRETCH_TIMEOUT
+uint8_t _I2CSoft_scl_release()
+{
+	_I2C_SOFT_SCL_RELEASE();
+	
+	//Sampling right after the DDR write still sees the old low level
+	__builtin_avr_delay_cycles(_I2C_SOFT_SETTLE_CYCLES);
+	
+	if (_I2C_SOFT_SCL_READ()) return 0;
+	
+	//Still low after the rise time, the slave is stretching the clock
+	I2CSoft_stretch_count++;
+	
+	for (uint16_t i = 0; i < I2C_SOFT_STRETCH_TIMEOUT; i++) if (_I2C_SOFT_SCL_READ()) return 0;
+	
+	_I2CSoft_timeout = 1;
+	return 1;
+}
+
+//START or repeated START
+//Returns 1 if another device holds SDA low
+uint8_t _I2CSoft_start()
+{
+	_I2CSoft_timeout = 0;
+	
+	_I2C_SOFT_SDA_RELEASE();
+	_I2C_SOFT_DELAY();
+	if (_I2CSoft_scl_release()) return 1;
+	_I2C_SOFT_HIGH_DELAY();
+	
+	if (!_I2C_SOFT_SDA_READ()) return 1;
+	
+	_I2C_SOFT_SDA_LOW();
+	_I2C_SOFT_DELAY();
+	_I2C_SOFT_SCL_LOW();
+	
+	return 0;
+}
+
+void _I2CSoft_stop()
+{
+	_I2C_SOFT_SDA_LOW();
+	_I2C_SOFT_DELAY();
+	_I2CSoft_scl_release();
+	_I2C_SOFT_HIGH_DELAY();
+	_I2C_SOFT_SDA_RELEASE();
+	_I2C_SOFT_DELAY();
+}
+
+//Returns 0 on ACK, 1 on NACK
+uint8_t _I2CSoft_write_byte(uint8_t value)
+{
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		if (value & 0x80) _I2C_SOFT_SDA_RELEASE();
+		else _I2C_SOFT_SDA_LOW();
+		
+		value <<= 1;
+		
+		_I2C_SOFT_DELAY();
+		if (_I2CSoft_scl_release()) return 1;
+		_I2C_SOFT_HIGH_DELAY();
+		_I2C_SOFT_SCL_LOW();
+	}
+	
+	//ACK bit
+	_I2C_SOFT_SDA_RELEASE();
+	_I2C_SOFT_DELAY();
+	if (_I2CSoft_scl_release()) return 1;
+	
+	uint8_t nack = _I2C_SOFT_SDA_READ()? 1 : 0;
+	
+	_I2C_SOFT_HIGH_DELAY();
+	_I2C_SOFT_SCL_LOW();
+	
+	return nack;
+}
+
+//ack: 1 to acknowledge the byte, 0 to NACK it (last byte)
+uint8_t _I2CSoft_read_byte(uint8_t ack)
+{
+	uint8_t value = 0;
+	
+	_I2C_SOFT_SDA_RELEASE();
+	
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		_I2C_SOFT_DELAY();
+		if (_I2CSoft_scl_release()) return 0;
+		
+		value <<= 1;
+		if (_I2C_SOFT_SDA_READ()) value |= 1;
+		
+		_I2C_SOFT_HIGH_DELAY();
+		_I2C_SOFT_SCL_LOW();
+	}
+	
+	if (ack) _I2C_SOFT_SDA_LOW();
+	
+	_I2C_SOFT_DELAY();
+	_I2CSoft_scl_release();
+	_I2C_SOFT_HIGH_DELAY();
+	_I2C_SOFT_SCL_LOW();
+	_I2C_SOFT_SDA_RELEASE();
+	
+	return value;
+}
+
+void _I2CSoft_backend_start()
+{
+	if (_I2CSoft_start()) _I2CSoft_status = _I2CSoft_timeout? C_BUS_TIMEOUT : MTR_ARB_LOST;
+	else _I2CSoft_status = _I2CSoft_active? MTR_REPSTART : MTR_START;
+	
+	_I2CSoft_active = 1;
+	_I2CSoft_addressing = 1;
+}
+
+void _I2CSoft_backend_write(uint8_t value)
+{
+	uint8_t nack = _I2CSoft_write_byte(value);
+	
+	//Same status codes as the TWI
+	if (_I2CSoft_timeout) _I2CSoft_status = C_BUS_TIMEOUT;
+	else if (!_I2CSoft_addressing) _I2CSoft_status = nack? MT_DATA_NACK : MT_DATA_ACK;
+	else if (value & 1) _I2CSoft_status = nack? MR_SLAR_NACK : MR_SLAR_ACK;
+	else _I2CSoft_status = nack? MT_SLAW_NACK : MT_SLAW_ACK;
+	
+	_I2CSoft_addressing = 0;
+}
+
+void _I2CSoft_backend_read(uint8_t ack)
+{
+	_I2CSoft_data = _I2CSoft_read_byte(ack);
+	
+	if (_I2CSoft_timeout) _I2CSoft_status = C_BUS_TIMEOUT;
+	else _I2CSoft_status = ack? MR_DATA_ACK : MR_DATA_NACK;
+}
+
+enum I2CTransmissionStatus _I2CSoft_backend_wait() {return _I2CSoft_status;}
+uint8_t _I2CSoft_backend_data() {return _I2CSoft_data;}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#ifndef I2CSOFT_H_
+#define I2CSOFT_H_
+
+#include "I2C.h"
+
+//Software (bit-banged) master on any port, only the bus primitives differ from the TWI master
+//Transmission modes, PEC and results are the shared protocol of I2CProtocol.c (needs I2C_FEATURE_MASTER)
+//Only I2CProtocol.c has to be linked, so parts without TWI are supported
+//Pins are open-drain emulated through DDR, external pull-ups are required
+
+#ifndef I2C_SOFT_PORT
+	#define I2C_SOFT_PORT PORTB
+	#define I2C_SOFT_DDR DDRB
+	#define I2C_SOFT_PIN PINB
+#endif
+
+#ifndef I2C_SOFT_SDA
+	#define I2C_SOFT_SDA 0 //Bit number in I2C_SOFT_PORT
+#endif
+
+#ifndef I2C_SOFT_SCL
+	#define I2C_SOFT_SCL 1 //Bit number in I2C_SOFT_PORT
+#endif
+
+//SCL frequency, bit timing is calculated at compile time from F_CPU
+#ifndef I2C_SOFT_FREQUENCY
+	#define I2C_SOFT_FREQUENCY 100000UL
+#endif
+
+//Cycles spent on port access, branching and looping in each half bit, subtracted from the delay
+//Estimated from -Os code, the benchmark mode of I2C_demo/I2CValidator reports the value matching the real SCL
+#ifndef I2C_SOFT_OVERHEAD
+	#define I2C_SOFT_OVERHEAD 8
+#endif
+
+//SCL rise time through the pull-up, a low level is only counted as clock stretching after it (I2C maximum: 1000 ns standard mode, 300 ns fast mode)
+#ifndef I2C_SOFT_RISE_TIME_NS
+	#define I2C_SOFT_RISE_TIME_NS 1000
+#endif
+
+//Maximum number of SCL polls while a slave stretches the clock
+#ifndef I2C_SOFT_STRETCH_TIMEOUT
+	#define I2C_SOFT_STRETCH_TIMEOUT 10000u
+#endif
+
+//Number of times a slave held SCL low
+extern uint16_t I2CSoft_stretch_count;
+
+void I2CSoft_init();
+enum I2CTransmissionResult I2CSoft_start_transmission(I2CMasterTransmission* transmission);
+enum I2CTransmissionResult I2CSoft_start_combined_transmission(I2CMasterTransmission* write, I2CMasterTransmission* read);
+
+#endif
@@ -0,0 +1,125 @@
+#include "SMBus.h"
+#include <string.h>
+
+enum I2CTransmissionResult _SMBus_write(uint8_t address, uint8_t* data, uint8_t length, uint8_t pec);
+enum I2CTransmissionResult _SMBus_write_read(uint8_t address, uint8_t* tx_data, uint8_t tx_length, uint8_t* rx_data, uint8_t rx_length, uint8_t config, uint16_t* received);
+
+enum I2CTransmissionResult SMBus_quick_command(uint8_t address, uint8_t read)
+{
+	//Only the R/W bit carries information, the stream is empty
+	//A quick read still clocks one dummy byte answered with NACK, the slave must release SDA before STOP
+	uint8_t dummy;
+	I2CMasterTransmission transmission = {.stream = {.buffer = (char*)&dummy, .length = 0}, .slave_address = address, .config = read? TCONFIG_MODE_READ : 0};
+	
+	return I2C_start_transmission(&transmission);
+}
+
+enum I2CTransmissionResult SMBus_send_byte(uint8_t address, uint8_t value, uint8_t pec)
+{
+	return _SMBus_write(address, &value, 1, pec);
+}
+
+enum I2CTransmissionResult SMBus_receive_byte(uint8_t address, uint8_t* value, uint8_t pec)
+{
+	I2CMasterTransmission transmission = {.stream = {.buffer = (char*)value, .length = 1}, .slave_address = address};
+	transmission.config = TCONFIG_MODE_READ | (pec? TCONFIG_ENABLE_PEC : 0);
+	
+	return I2C_start_transmission(&transmission);
+}
+
+enum I2CTransmissionResult SMBus_write_byte(uint8_t address, uint8_t command, uint8_t value, uint8_t pec)
+{
+	uint8_t data[2] = {command, value};
+	return _SMBus_write(address, data, 2, pec);
+}
+
+enum I2CTransmissionResult SMBus_read_byte(uint8_t address, uint8_t command, uint8_t* value, uint8_t pec)
+{
+	return _SMBus_write_read(address, &command, 1, value, 1, pec? TCONFIG_ENABLE_PEC : 0, NULL);
+}
+
+//Words are transferred low byte first
+enum I2CTransmissionResult SMBus_write_word(uint8_t address, uint8_t command, uint16_t value, uint8_t pec)
+{
+	uint8_t data[3] = {command, value & 0xFF, value >> 8};
+	return _SMBus_write(address, data, 3, pec);
+}
+
+enum I2CTransmissionResult SMBus_read_word(uint8_t address, uint8_t command, uint16_t* value, uint8_t pec)
+{
+	uint8_t data[2];
+	enum I2CTransmissionResult result = _SMBus_write_read(address, &command, 1, data, 2, pec? TCONFIG_ENABLE_PEC : 0, NULL);
+	
+	*value = data[0] | (data[1] << 8);
+	return result;
+}
+
+enum I2CTransmissionResult SMBus_process_call(uint8_t address, uint8_t command, uint16_t value, uint16_t* result, uint8_t pec)
+{
+	uint8_t tx_data[3] = {command, value & 0xFF, value >> 8};
+	uint8_t rx_data[2];
+	enum I2CTransmissionResult transmission_result = _SMBus_write_read(address, tx_data, 3, rx_data, 2, pec? TCONFIG_ENABLE_PEC : 0, NULL);
+	
+	*result = rx_data[0] | (rx_data[1] << 8);
+	return transmission_result;
+}
+
+enum I2CTransmissionResult SMBus_block_write(uint8_t address, uint8_t command, uint8_t* data, uint8_t length, uint8_t pec)
+{
+	if (length > SMBUS_BLOCK_MAX) return INTERNAL_ERROR;
+	
+	//command, byte count, data
+	uint8_t frame[SMBUS_BLOCK_MAX + 2];
+	frame[0] = command;
+	frame[1] = length;
+	memcpy(frame + 2, data, length);
+	
+	return _SMBus_write(address, frame, length + 2, pec);
+}
+
+enum I2CTransmissionResult SMBus_block_read(uint8_t address, uint8_t command, uint8_t* data, uint8_t* length, uint8_t pec)
+{
+	uint16_t received = 0;
+	enum I2CTransmissionResult result = _SMBus_write_read(address, &command, 1, data, SMBUS_BLOCK_MAX, TCONFIG_ENABLE_LENGTH_PREFIX | (pec? TCONFIG_ENABLE_PEC : 0), &received);
+	
+	*length = received;
+	return result;
+}
+
+enum I2CTransmissionResult SMBus_block_process_call(uint8_t address, uint8_t command, uint8_t* tx_data, uint8_t tx_length, uint8_t* rx_data, uint8_t* rx_length, uint8_t pec)
+{
+	if (tx_length > SMBUS_BLOCK_MAX) return INTERNAL_ERROR;
+	
+	uint8_t frame[SMBUS_BLOCK_MAX + 2];
+	frame[0] = command;
+	frame[1] = tx_length;
+	memcpy(frame + 2, tx_data, tx_length);
+	
+	uint16_t received = 0;
+	enum I2CTransmissionResult result = _SMBus_write_read(address, frame, tx_length + 2, rx_data, SMBUS_BLOCK_MAX, TCONFIG_ENABLE_LENGTH_PREFIX | (pec? TCONFIG_ENABLE_PEC : 0), &received);
+	
+	*rx_length = received;
+	return result;
+}
+
+enum I2CTransmissionResult _SMBus_write(uint8_t address, uint8_t* data, uint8_t length, uint8_t pec)
+{
+	I2CMasterTransmission transmission = {.stream = {.buffer = (char*)data, .length = length}, .slave_address = address};
+	transmission.config = pec? TCONFIG_ENABLE_PEC : 0;
+	
+	return I2C_start_transmission(&transmission);
+}
+
+//config: read phase transmission config (TCONFIG_MODE_READ is added)
+//received: number of bytes received in the read phase (optional)
+enum I2CTransmissionResult _SMBus_write_read(uint8_t address, uint8_t* tx_data, uint8_t tx_length, uint8_t* rx_data, uint8_t rx_length, uint8_t config, uint16_t* received)
+{
+	I2CMasterTransmission write = {.stream = {.buffer = (char*)tx_data, .length = tx_length}, .slave_address = address};
+	I2CMasterTransmission read = {.stream = {.buffer = (char*)rx_data, .length = rx_length}, .slave_address = address};
+	read.config = TCONFIG_MODE_READ | config;
+	
+	enum I2CTransmissionResult result = I2C_start_combined_transmission(&write, &read);
+	
+	if (received) *received = read.bytes_transmitted;
+	return result;
+}
@@ -0,0 +1,23 @@
+#ifndef SMBUS_H_
+#define SMBUS_H_
+
+#include "I2C.h"
+
+#define SMBUS_BLOCK_MAX 32
+
+//All functions take pec != 0 to enable Packet Error Checking
+enum I2CTransmissionResult SMBus_quick_command(uint8_t address, uint8_t read);
+enum I2CTransmissionResult SMBus_send_byte(uint8_t address, uint8_t value, uint8_t pec);
+enum I2CTransmissionResult SMBus_receive_byte(uint8_t address, uint8_t* value, uint8_t pec);
+enum I2CTransmissionResult SMBus_write_byte(uint8_t address, uint8_t command, uint8_t value, uint8_t pec);
+enum I2CTransmissionResult SMBus_read_byte(uint8_t address, uint8_t command, uint8_t* value, uint8_t pec);
+enum I2CTransmissionResult SMBus_write_word(uint8_t address, uint8_t command, uint16_t value, uint8_t pec);
+enum I2CTransmissionResult SMBus_read_word(uint8_t address, uint8_t command, uint16_t* value, uint8_t pec);
+enum I2CTransmissionResult SMBus_process_call(uint8_t address, uint8_t command, uint16_t value, uint16_t* result, uint8_t pec);
+
+//data must hold SMBUS_BLOCK_MAX bytes on reads, length returns the number of bytes received
+enum I2CTransmissionResult SMBus_block_write(uint8_t address, uint8_t command, uint8_t* data, uint8_t length, uint8_t pec);
+enum I2CTransmissionResult SMBus_block_read(uint8_t address, uint8_t command, uint8_t* data, uint8_t* length, uint8_t pec);
+enum I2CTransmissionResult SMBus_block_process_call(uint8_t address, uint8_t command, uint8_t* tx_data, uint8_t tx_length, uint8_t* rx_data, uint8_t* rx_length, uint8_t pec);
+
+#endif
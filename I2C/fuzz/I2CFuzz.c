@@ -0,0 +1,561 @@
+#include "../I2C.h"
+#include "TWIModel.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef I2C_FEATURE_MASTER
+	#include "../SMBus.h"
+	#include "../EEPROM24C.h"
+#endif
+
+//Fuzz target for the TWI state machine: every input is one scenario against the model in TWIModel.c
+//The first bytes pick the configuration, then each step runs an operation (master transmission,
+//SMBus or EEPROM call, address match by another master, sleep) until the input is used up
+//Checks: sanitizers for memory safety, TWIModel for the datasheet state tables and bounded ISR work,
+//the stream length invariants below after every step
+
+#define I2CFUZZ_TRANSMISSION_MAX 24
+#define I2CFUZZ_DEVICE_STREAM_MAX 8
+
+#define I2CFuzz_assert(condition, message) do {if (!(condition)) TWIModel_fail("%s", message);} while(0)
+
+//Internal state of I2C.c that I2C_init does not reset, an earlier input may have ended mid-transaction
+#ifdef I2C_FEATURE_SLAVE
+	extern I2CSlaveDevice* _I2C_current_device;
+#endif
+
+#ifdef I2C_FEATURE_LOW_POWER
+	extern volatile uint8_t _I2C_addressed;
+	extern volatile uint8_t _I2C_woken;
+#endif
+
+#ifdef I2C_BUFFERED_MODE
+	extern I2CSlaveTransmission* _I2C_current_rx_transmission;
+#endif
+
+#ifdef I2C_FEATURE_MASTER
+	uint16_t _EEPROM24C_default_poll_limit(uint8_t slave_address);
+#endif
+
+I2CConfig _I2CFuzz_config;
+
+#ifdef I2C_FEATURE_SLAVE
+	I2CSlaveDevice _I2CFuzz_devices[I2C_SLAVE_DEVICES_MAX];
+	uint8_t _I2CFuzz_device_count;
+	uint16_t _I2CFuzz_tx_allocated[I2C_SLAVE_DEVICES_MAX];
+#endif
+
+#ifdef I2C_FEATURE_MASTER
+	//Kept outside the steps so buffers grown by the library are freed when the input ends mid-transaction
+	I2CMasterTransmission _I2CFuzz_write;
+	I2CMasterTransmission _I2CFuzz_read;
+#endif
+
+void _I2CFuzz_setup();
+uint8_t _I2CFuzz_mode_compiled(enum I2CMode mode);
+void _I2CFuzz_teardown();
+void _I2CFuzz_check();
+uint8_t _I2CFuzz_sum(const char* buffer, uint16_t length);
+
+//Steps
+void _I2CFuzz_address();
+void _I2CFuzz_transmission();
+void _I2CFuzz_combined();
+void _I2CFuzz_smbus();
+void _I2CFuzz_eeprom();
+void _I2CFuzz_sleep();
+void _I2CFuzz_general_call();
+void _I2CFuzz_diagnostics();
+
+#ifdef I2C_FEATURE_SLAVE
+	void _I2CFuzz_on_device_receive(I2CSlaveDevice* device);
+	void _I2CFuzz_on_device_request(I2CSlaveDevice* device);
+#endif
+
+#ifdef I2C_BUFFERED_MODE
+	void _I2CFuzz_on_receive(I2CStream stream);
+#endif
+
+void (*const _I2CFuzz_steps[])() = {
+	_I2CFuzz_address,
+	#ifdef I2C_FEATURE_MASTER
+		_I2CFuzz_transmission,
+		_I2CFuzz_combined,
+		_I2CFuzz_smbus,
+		_I2CFuzz_eeprom,
+	#endif
+	#ifdef I2C_FEATURE_LOW_POWER
+		_I2CFuzz_sleep,
+	#endif
+	#ifdef I2C_FEATURE_SLAVE
+		_I2CFuzz_general_call,
+	#endif
+	#if defined(I2C_FEATURE_STATS) || defined(I2C_FEATURE_TRACE)
+		_I2CFuzz_diagnostics,
+	#endif
+};
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	TWIModel_attach(data, size);
+	
+	if (!setjmp(TWIModel_end))
+	{
+		_I2CFuzz_setup();
+		
+		while (1)
+		{
+			uint8_t step = TWIModel_input();
+			
+			//Callers may hold interrupts off, the ISR then runs only after the step
+			if (step & 0x80) cli();
+			
+			_I2CFuzz_steps[(step & 0x7F) % (sizeof(_I2CFuzz_steps) / sizeof(_I2CFuzz_steps[0]))]();
+			
+			sei();
+			_I2CFuzz_check();
+		}
+	}
+	
+	TWIModel_detach();
+	_I2CFuzz_teardown();
+	
+	return 0;
+}
+
+void _I2CFuzz_setup()
+{
+	_I2CFuzz_config.mode = TWIModel_input() % 3;
+	
+	static const uint32_t frequencies[] = {50000, 100000, 400000};
+	_I2CFuzz_config.frequency = frequencies[TWIModel_input() % 3];
+	_I2CFuzz_config.address = 0x08 + TWIModel_input() % 0x70;
+	_I2CFuzz_config.address_mask = TWIModel_input() % 4 == 0? TWIModel_input() & 0x07 : 0;
+	_I2CFuzz_config.recognize_general_call = TWIModel_input() & 1;
+	
+	#ifdef I2C_FEATURE_MULTI_MASTER
+		TWIModel_multi_master = _I2CFuzz_config.mode == MULTI_MASTER;
+	#endif
+	
+	//Modes without their slice must be rejected, there is nothing to run then
+	if (!_I2CFuzz_mode_compiled(_I2CFuzz_config.mode))
+	{
+		I2CFuzz_assert(I2C_init(&_I2CFuzz_config) == 3, "I2C_init accepted a mode that is not compiled in");
+		longjmp(TWIModel_end, 1);
+	}
+	
+	I2CFuzz_assert(I2C_init(&_I2CFuzz_config) == 0, "I2C_init rejected a valid configuration");
+	I2C_enable();
+	sei();
+	
+	#ifdef I2C_FEATURE_MASTER
+		static const I2CDeviceTiming timings[] = {I2C_DEVICE_TIMING(0x50, 400000), I2C_DEVICE_TIMING(0x51, 10000)};
+		I2C_set_device_timings(timings, TWIModel_input() % 3);
+	#endif
+	
+	#ifdef I2C_FEATURE_LOW_POWER
+		_I2C_addressed = 0;
+		_I2C_woken = 0;
+	#endif
+	
+	#ifdef I2C_BUFFERED_MODE
+		if (TWIModel_input() & 1) I2C_on_receive_subscribe(_I2CFuzz_on_receive);
+	#endif
+	
+	#ifdef I2C_FEATURE_SLAVE
+		_I2CFuzz_device_count = 0;
+		
+		uint8_t count = TWIModel_input() % (I2C_SLAVE_DEVICES_MAX + 1);
+		uint8_t mask = _I2CFuzz_config.address_mask;
+		
+		for (uint8_t i = 0; i < count; i++)
+		{
+			//Counted before the buffers are allocated, the input may end in between
+			I2CSlaveDevice* device = &_I2CFuzz_devices[_I2CFuzz_device_count++];
+			*device = (I2CSlaveDevice){0};
+			
+			device -> address = (_I2CFuzz_config.address & ~mask) | (TWIModel_input() & mask);
+			device -> rx_stream.length = TWIModel_input() % I2CFUZZ_DEVICE_STREAM_MAX;
+			device -> rx_stream.buffer = malloc(device -> rx_stream.length);
+			device -> tx_stream.length = TWIModel_input() % I2CFUZZ_DEVICE_STREAM_MAX;
+			device -> tx_stream.buffer = calloc(1, device -> tx_stream.length);
+			_I2CFuzz_tx_allocated[i] = device -> tx_stream.length;
+			device -> on_receive = _I2CFuzz_on_device_receive;
+			device -> on_request = TWIModel_input() & 1? _I2CFuzz_on_device_request : NULL;
+			
+			I2CFuzz_assert(I2C_slave_register(device) == 0, "I2C_slave_register rejected a device");
+		}
+	#endif
+}
+
+uint8_t _I2CFuzz_mode_compiled(enum I2CMode mode)
+{
+	switch (mode)
+	{
+		#ifdef I2C_FEATURE_MASTER
+			#ifdef I2C_FEATURE_MULTI_MASTER
+				case MULTI_MASTER:
+			#endif
+			case MASTER:
+		#endif
+		#ifdef I2C_FEATURE_SLAVE
+			case SLAVE:
+		#endif
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+void _I2CFuzz_teardown()
+{
+	#ifdef I2C_FEATURE_SLAVE
+		for (uint8_t i = 0; i < _I2CFuzz_device_count; i++)
+		{
+			I2C_slave_unregister(&_I2CFuzz_devices[i]);
+			
+			free(_I2CFuzz_devices[i].rx_stream.buffer);
+			free(_I2CFuzz_devices[i].tx_stream.buffer);
+		}
+		
+		_I2CFuzz_device_count = 0;
+		_I2C_current_device = NULL;
+	#endif
+	
+	#ifdef I2C_FEATURE_MASTER
+		free(_I2CFuzz_write.stream.buffer);
+		free(_I2CFuzz_read.stream.buffer);
+		
+		_I2CFuzz_write.stream.buffer = NULL;
+		_I2CFuzz_read.stream.buffer = NULL;
+	#endif
+	
+	#ifdef I2C_BUFFERED_MODE
+		if (_I2C_current_rx_transmission)
+		{
+			free(_I2C_current_rx_transmission -> stream.buffer);
+			free(_I2C_current_rx_transmission);
+			_I2C_current_rx_transmission = NULL;
+		}
+	#endif
+}
+
+//After every step the bus has to be released, the library idle and ready for the next transaction
+void _I2CFuzz_check()
+{
+	//A slave transaction that won arbitration against the master is finished by the ISR
+	TWIModel_run();
+	
+	I2CFuzz_assert(TWIModel_idle(), "bus not released after the step");
+	I2CFuzz_assert(I2C_transmission_ended, "I2C_transmission_ended not set while idle");
+	I2CFuzz_assert(TWIModel_peek() & TWIMODEL_EA, "own address recognition (TWEA) left disabled");
+	
+	#ifdef I2C_FEATURE_SLAVE
+		I2CFuzz_assert(_I2CFuzz_config.mode == MASTER || (TWIModel_peek() & TWIMODEL_INTEN), "TWI interrupt left disabled in a slave configuration");
+	#else
+		I2CFuzz_assert(!(TWIModel_peek() & TWIMODEL_INTEN), "TWI interrupt enabled without ISR(TWI_vect)");
+	#endif
+}
+
+//Touches every byte the length claims, the sanitizer reports lengths past the allocation
+uint8_t _I2CFuzz_sum(const char* buffer, uint16_t length)
+{
+	uint8_t sum = 0;
+	for (uint16_t i = 0; i < length; i++) sum += buffer[i];
+	
+	return sum;
+}
+
+void _I2CFuzz_address()
+{
+	TWIModel_address();
+	TWIModel_run();
+}
+
+#ifdef I2C_FEATURE_SLAVE
+void _I2CFuzz_on_device_receive(I2CSlaveDevice* device)
+{
+	I2CFuzz_assert(device -> bytes_received <= device -> rx_stream.length, "device received past rx_stream");
+	I2CFuzz_assert(device -> bytes_received >= TWIModel_slave_acked, "device acknowledged a byte it did not store");
+	_I2CFuzz_sum(device -> rx_stream.buffer, device -> bytes_received);
+}
+
+void _I2CFuzz_on_device_request(I2CSlaveDevice* device)
+{
+	//Reply length may change per request, up to the allocated buffer
+	device -> tx_stream.length = TWIModel_input() % (_I2CFuzz_tx_allocated[device - _I2CFuzz_devices] + 1);
+}
+
+void _I2CFuzz_general_call()
+{
+	if (TWIModel_input() & 1) I2C_enable_GC_recognition();
+	else I2C_disable_GC_recognition();
+}
+#endif
+
+#if defined(I2C_FEATURE_STATS) || defined(I2C_FEATURE_TRACE)
+void _I2CFuzz_diagnostics()
+{
+	#ifdef I2C_FEATURE_STATS
+		I2CFuzz_assert(I2C_stats.errors <= I2C_stats.transmissions, "more errors than transmissions");
+		if (TWIModel_input() & 1) I2C_stats_reset();
+	#endif
+	
+	#ifdef I2C_FEATURE_TRACE
+		I2CTraceEntry entries[I2C_TRACE_SIZE];
+		I2C_trace_dump(entries, TWIModel_input() % (I2C_TRACE_SIZE + 1));
+		if (TWIModel_input() & 1) I2C_trace_clear();
+	#endif
+}
+#endif
+
+#ifdef I2C_BUFFERED_MODE
+//The handler owns the buffer
+void _I2CFuzz_on_receive(I2CStream stream)
+{
+	//Buffered mode acknowledges every byte and keeps it
+	I2CFuzz_assert(stream.length == TWIModel_slave_acked, "buffered write handed over with another length than received");
+	
+	_I2CFuzz_sum(stream.buffer, stream.length);
+	free(stream.buffer);
+}
+#endif
+
+#ifdef I2C_FEATURE_LOW_POWER
+void _I2CFuzz_sleep()
+{
+	I2C_sleep_until_address();
+	TWIModel_run();
+}
+#endif
+
+#ifdef I2C_FEATURE_MASTER
+//Stream exactly as long as its allocation, the sanitizer catches any access past it
+void _I2CFuzz_build(I2CMasterTransmission* transmission, uint8_t read)
+{
+	uint16_t length = TWIModel_input() % I2CFUZZ_TRANSMISSION_MAX;
+	uint8_t options = TWIModel_input();
+	
+	*transmission = (I2CMasterTransmission){.stream = {.buffer = malloc(length), .length = length}};
+	for (uint16_t i = 0; i < length; i++) transmission -> stream.buffer[i] = i * 37;
+	
+	transmission -> slave_address = TWIModel_input() & 0x7F;
+	transmission -> config = (read? TCONFIG_MODE_READ : 0) | (options & TCONFIG_ENABLE_PEC);
+	
+	#ifdef I2C_FEATURE_TERMINATOR
+		transmission -> config |= options & TCONFIG_ENABLE_TERMINATOR;
+		transmission -> terminator = TWIModel_input();
+	#endif
+	
+	if (read) transmission -> config |= options & TCONFIG_ENABLE_LENGTH_PREFIX;
+}
+
+//SMBus PEC computed bit by bit, independent of the table in I2CProtocol.c
+uint8_t _I2CFuzz_crc8(const uint8_t* data, uint16_t length)
+{
+	uint8_t crc = 0;
+	
+	for (uint16_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for (uint8_t bit = 0; bit < 8; bit++) crc = crc & 0x80? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	
+	return crc;
+}
+
+//Reads that end on an ACKed byte clock one more byte with NACK before STOP, it is not part of the PEC
+uint8_t _I2CFuzz_dummy(I2CMasterTransmission* transmission)
+{
+	if (!(transmission -> config & TCONFIG_MODE) || (transmission -> config & TCONFIG_PEC)) return 0;
+	if (transmission -> config & TCONFIG_TERMINATOR) return 1;
+	if (transmission -> config & TCONFIG_LENGTH_PREFIX) return TWIModel_bus.bytes[TWIModel_bus.data] == 0;
+	
+	return transmission -> stream.length == 0;
+}
+
+//Invariants of a finished transmission, the bus transcript is compared when it succeeded
+//last: transmission that ended the transaction (read phase of a combined transmission)
+void _I2CFuzz_check_transmission(I2CMasterTransmission* transmission, enum I2CTransmissionResult result, uint8_t last)
+{
+	I2CFuzz_assert(result != BUS_TIMEOUT && result <= BUS_TIMEOUT, "unexpected result from the TWI master");
+	I2CFuzz_assert(transmission -> bytes_transmitted <= transmission -> stream.length, "bytes_transmitted past stream.length");
+	_I2CFuzz_sum(transmission -> stream.buffer, transmission -> stream.length);
+	
+	if (!last || result != SUCCESS || TWIModel_bus.truncated) return;
+	
+	const uint8_t* bus = TWIModel_bus.bytes;
+	uint16_t length = TWIModel_bus.length;
+	uint8_t pec = (transmission -> config & TCONFIG_PEC) != 0;
+	uint8_t dummy = _I2CFuzz_dummy(transmission);
+	
+	//PEC covers everything from the first SLA+R/W, a PEC byte on the bus is the last one
+	if (pec)
+	{
+		I2CFuzz_assert(length && bus[length - 1] == _I2CFuzz_crc8(bus, length - 1), "PEC accepted that does not match the bus");
+		I2CFuzz_assert(transmission -> pec == bus[length - 1], "transmission pec differs from the PEC byte");
+	}
+	else I2CFuzz_assert(transmission -> pec == _I2CFuzz_crc8(bus, length - dummy), "transmission pec differs from the bus");
+	
+	if (!(transmission -> config & TCONFIG_MODE) || (transmission -> config & (TCONFIG_TERMINATOR | TCONFIG_LENGTH_PREFIX))) return;
+	
+	//Fixed length read: SLA+R, data, PEC or the dummy byte that ends a zero length read
+	I2CFuzz_assert(transmission -> bytes_transmitted == transmission -> stream.length, "read succeeded short");
+	I2CFuzz_assert(length == TWIModel_bus.data + transmission -> stream.length + pec + dummy, "read clocked a different number of bytes");
+	I2CFuzz_assert(!memcmp(transmission -> stream.buffer, bus + TWIModel_bus.data, transmission -> stream.length), "read stored other bytes than the bus carried");
+}
+
+void _I2CFuzz_transmission()
+{
+	_I2CFuzz_build(&_I2CFuzz_write, TWIModel_input() & 1);
+	
+	enum I2CTransmissionResult result = I2C_start_transmission(&_I2CFuzz_write);
+	_I2CFuzz_check_transmission(&_I2CFuzz_write, result, 1);
+	
+	free(_I2CFuzz_write.stream.buffer);
+	_I2CFuzz_write.stream.buffer = NULL;
+}
+
+void _I2CFuzz_combined()
+{
+	_I2CFuzz_build(&_I2CFuzz_write, 0);
+	_I2CFuzz_build(&_I2CFuzz_read, 1);
+	
+	uint8_t config = _I2CFuzz_write.config;
+	enum I2CTransmissionResult result = I2C_start_combined_transmission(&_I2CFuzz_write, &_I2CFuzz_read);
+	I2CFuzz_assert(_I2CFuzz_write.config == config, "combined transmission changed the config of the write phase");
+	_I2CFuzz_check_transmission(&_I2CFuzz_write, result, 0);
+	_I2CFuzz_check_transmission(&_I2CFuzz_read, result, 1);
+	
+	free(_I2CFuzz_write.stream.buffer);
+	free(_I2CFuzz_read.stream.buffer);
+	_I2CFuzz_write.stream.buffer = NULL;
+	_I2CFuzz_read.stream.buffer = NULL;
+}
+
+void _I2CFuzz_smbus()
+{
+	uint8_t address = TWIModel_input() & 0x7F;
+	uint8_t pec = TWIModel_input() & 1;
+	
+	//Block buffers in the transmission slots so they are freed if the input ends
+	_I2CFuzz_read.stream.buffer = malloc(SMBUS_BLOCK_MAX);
+	uint8_t* data = (uint8_t*)_I2CFuzz_read.stream.buffer;
+	uint8_t length = 0;
+	
+	switch (TWIModel_input() % 3)
+	{
+		case 0:
+			SMBus_quick_command(address, TWIModel_input() & 1);
+			break;
+		
+		case 1:
+			SMBus_block_read(address, TWIModel_input(), data, &length, pec);
+			I2CFuzz_assert(length <= SMBUS_BLOCK_MAX, "SMBus block longer than SMBUS_BLOCK_MAX");
+			break;
+		
+		default:
+		{
+			uint8_t tx_length = TWIModel_input() % (SMBUS_BLOCK_MAX + 2);
+			uint8_t tx_data[SMBUS_BLOCK_MAX + 1] = {0};
+			
+			SMBus_block_process_call(address, TWIModel_input(), tx_data, tx_length, data, &length, pec);
+			I2CFuzz_assert(length <= SMBUS_BLOCK_MAX, "SMBus block longer than SMBUS_BLOCK_MAX");
+			break;
+		}
+	}
+	
+	free(_I2CFuzz_read.stream.buffer);
+	_I2CFuzz_read.stream.buffer = NULL;
+}
+
+void _I2CFuzz_eeprom()
+{
+	static const uint8_t page_sizes[] = {0, 8, 16, 32, 64, 128};
+	
+	EEPROM24C eeprom = {
+		.address = 0x50 + TWIModel_input() % 8,
+		.address_bytes = 1 + TWIModel_input() % 2,
+		.page_size = page_sizes[TWIModel_input() % sizeof(page_sizes)],
+		.poll_limit = TWIModel_input() % 4,
+		.busy = TWIModel_input() & 1
+	};
+	
+	//The default poll budget follows the bit rate of the EEPROM, TWBR may still hold the one of another device
+	uint16_t limit = _EEPROM24C_default_poll_limit(eeprom.address);
+	TWBR = TWIModel_input();
+	I2CFuzz_assert(_EEPROM24C_default_poll_limit(eeprom.address) == limit, "EEPROM poll budget taken from the bit rate in TWBR");
+	
+	uint16_t length = TWIModel_input() % (2 * EEPROM24C_PAGE_MAX);
+	uint16_t memory_address = TWIModel_input() << 4;
+	
+	_I2CFuzz_read.stream.buffer = calloc(1, length);
+	
+	if (TWIModel_input() & 1) EEPROM24C_write(&eeprom, memory_address, (uint8_t*)_I2CFuzz_read.stream.buffer, length);
+	else EEPROM24C_read(&eeprom, memory_address, (uint8_t*)_I2CFuzz_read.stream.buffer, length);
+	
+	free(_I2CFuzz_read.stream.buffer);
+	_I2CFuzz_read.stream.buffer = NULL;
+}
+#endif
+
+#ifdef I2CFUZZ_MAIN
+//Without libFuzzer: runs every file given (AFL, reproducing a failure), stdin without arguments
+//-random N [file] runs N generated inputs instead, each is written to file first so a failing one can be replayed
+int main(int argc, char** argv)
+{
+	static uint8_t data[4096];
+	
+	if (argc >= 3 && !strcmp(argv[1], "-random"))
+	{
+		uint32_t seed = 1;
+		long runs = atol(argv[2]);
+		
+		for (long run = 0; run < runs; run++)
+		{
+			size_t size = 1 + run % sizeof(data);
+			
+			for (size_t i = 0; i < size; i++)
+			{
+				seed = seed * 1103515245 + 12345;
+				data[i] = seed >> 16;
+			}
+			
+			if (argc > 3)
+			{
+				FILE* file = fopen(argv[3], "wb");
+				if (file == NULL)
+				{
+					perror(argv[3]);
+					return 1;
+				}
+				
+				fwrite(data, 1, size, file);
+				fclose(file);
+			}
+			
+			LLVMFuzzerTestOneInput(data, size);
+		}
+		
+		printf("%ld inputs\n", runs);
+		return 0;
+	}
+	
+	for (int i = argc > 1? 1 : 0; i < argc; i++)
+	{
+		FILE* file = argc > 1? fopen(argv[i], "rb") : stdin;
+		if (file == NULL)
+		{
+			perror(argv[i]);
+			return 1;
+		}
+		
+		size_t size = fread(data, 1, sizeof(data), file);
+		if (file != stdin) fclose(file);
+		
+		LLVMFuzzerTestOneInput(data, size);
+	}
+	
+	return 0;
+}
+#endif
@@ -0,0 +1,477 @@
+#include "../I2C.h"
+#include "avr/sleep.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+volatile uint8_t TWIModel_twsr;
+volatile uint8_t TWIModel_twdr;
+volatile uint8_t TWIModel_sreg_i;
+volatile uint8_t TWIModel_sleep_mode;
+volatile uint8_t TWIModel_sleep_enabled;
+uint8_t TWIModel_multi_master;
+
+volatile uint8_t TWBR;
+volatile uint8_t TWAR;
+volatile uint8_t TWAMR;
+volatile uint8_t PORTC;
+volatile uint16_t TCNT1;
+
+TWIModelBus TWIModel_bus;
+uint16_t TWIModel_slave_acked;
+jmp_buf TWIModel_end;
+
+struct{
+	const uint8_t* data;
+	size_t size;
+	size_t position;
+	
+	uint8_t attached;
+	
+	uint8_t twcr; //Control bits, TWINT is kept in flag
+	uint8_t flag; //TWINT
+	uint8_t status;
+	
+	uint8_t pending; //Bus action started by clearing TWINT (or START from idle), not completed yet
+	uint8_t from; //Status the pending action was started in
+	uint8_t sta;
+	uint8_t sto;
+	
+	uint8_t in_isr;
+	uint16_t isr_accesses;
+	uint16_t polls;
+} _TWIModel;
+
+void _TWIModel_tick();
+void _TWIModel_begin(uint8_t value);
+void _TWIModel_complete();
+void _TWIModel_interrupt();
+void _TWIModel_raise(uint8_t status);
+void _TWIModel_release();
+void _TWIModel_record(uint8_t value);
+uint8_t _TWIModel_own_address(uint8_t rw, uint8_t general_call);
+uint8_t _TWIModel_stop_allowed(uint8_t status);
+
+void TWIModel_attach(const uint8_t* data, size_t size)
+{
+	_TWIModel.data = data;
+	_TWIModel.size = size;
+	_TWIModel.position = 0;
+	
+	_TWIModel.twcr = 0;
+	_TWIModel.flag = 0;
+	_TWIModel.status = TWIMODEL_IDLE;
+	_TWIModel.pending = 0;
+	_TWIModel.in_isr = 0;
+	_TWIModel.polls = 0;
+	
+	TWIModel_twsr = TWIMODEL_IDLE;
+	TWIModel_twdr = 0xFF;
+	TWIModel_sreg_i = 0;
+	TWIModel_sleep_enabled = 0;
+	TWIModel_multi_master = 0;
+	TWIModel_bus.length = 0;
+	TWIModel_bus.truncated = 0;
+	
+	TWBR = TWAR = TWAMR = PORTC = 0;
+	
+	_TWIModel.attached = 1;
+}
+
+//Registers turn into plain memory, used to tear down after the input ended mid-transaction
+void TWIModel_detach() {_TWIModel.attached = 0;}
+
+uint8_t TWIModel_input()
+{
+	if (_TWIModel.position >= _TWIModel.size) longjmp(TWIModel_end, 1);
+	
+	return _TWIModel.data[_TWIModel.position++];
+}
+
+void __sanitizer_print_stack_trace() __attribute__((weak));
+
+void TWIModel_fail(const char* format, ...)
+{
+	va_list arguments;
+	va_start(arguments, format);
+	
+	fprintf(stderr, "TWI model: ");
+	vfprintf(stderr, format, arguments);
+	fprintf(stderr, " (status 0x%02X, TWCR 0x%02X, input offset %zu)\n", _TWIModel.status, _TWIModel.twcr | (_TWIModel.flag? TWIMODEL_INT : 0), _TWIModel.position);
+	
+	va_end(arguments);
+	
+	//Sanitizer runtime, shows the library routine that broke the rule
+	if (__sanitizer_print_stack_trace) __sanitizer_print_stack_trace();
+	abort();
+}
+
+//Every register access is an instruction boundary: a pending bus action completes (the byte time has passed)
+//and a pending interrupt is taken, the ISR itself is too short for the bus to move
+void _TWIModel_tick()
+{
+	if (!_TWIModel.attached) return;
+	
+	if (_TWIModel.in_isr)
+	{
+		_TWIModel.isr_accesses++;
+		return;
+	}
+	
+	if (_TWIModel.pending) _TWIModel_complete();
+	if (_TWIModel.flag && (_TWIModel.twcr & TWIMODEL_INTEN) && TWIModel_sreg_i) _TWIModel_interrupt();
+}
+
+uint8_t TWIModel_read()
+{
+	_TWIModel_tick();
+	
+	if (_TWIModel.attached && !_TWIModel.in_isr && !_TWIModel.flag && !_TWIModel.pending)
+	{
+		TWIModel_assert(++_TWIModel.polls <= TWIMODEL_POLL_MAX, "TWINT is polled but no bus action is in progress");
+	}
+	
+	return _TWIModel.twcr | (_TWIModel.flag? TWIMODEL_INT : 0);
+}
+
+void TWIModel_write(uint8_t value)
+{
+	_TWIModel_tick();
+	
+	if (!_TWIModel.attached)
+	{
+		_TWIModel.twcr = value & ~TWIMODEL_INT;
+		return;
+	}
+	
+	_TWIModel.polls = 0;
+	
+	uint8_t clear = (value & TWIMODEL_INT) && _TWIModel.flag;
+	uint8_t start = (value & TWIMODEL_INT) && (value & TWIMODEL_STA) && !_TWIModel.flag && !_TWIModel.pending && _TWIModel.status == TWIMODEL_IDLE;
+	
+	_TWIModel.twcr = value & ~TWIMODEL_INT;
+	
+	//Disabling the TWI aborts everything, the bus is released
+	if (!(value & TWIMODEL_EN))
+	{
+		TWIModel_assert(!_TWIModel.in_isr, "TWI disabled from the ISR");
+		
+		_TWIModel.flag = 0;
+		_TWIModel.pending = 0;
+		_TWIModel.status = TWIMODEL_IDLE;
+		return;
+	}
+	
+	if (clear) _TWIModel_begin(value);
+	else if (start)
+	{
+		_TWIModel.from = TWIMODEL_IDLE;
+		_TWIModel.pending = 1;
+	}
+}
+
+volatile uint8_t* TWIModel_access(volatile uint8_t* reg)
+{
+	_TWIModel_tick();
+	
+	//Status bits are read-only, a write to TWSR only sets the prescaler
+	if (reg == &TWIModel_twsr) TWIModel_twsr = (TWIModel_twsr & 0x03) | _TWIModel.status;
+	
+	return reg;
+}
+
+//TWINT cleared: checks the requested action against the state tables (ATmega328P datasheet, 22.7) and starts it
+void _TWIModel_begin(uint8_t value)
+{
+	uint8_t status = _TWIModel.status;
+	
+	_TWIModel.sta = (value & TWIMODEL_STA) != 0;
+	_TWIModel.sto = (value & TWIMODEL_STO) != 0;
+	
+	TWIModel_assert(status < SR_SLAW_ACK || status > ST_DATA_DONE || _TWIModel.in_isr, "slave state acknowledged outside ISR(TWI_vect)");
+	TWIModel_assert(!_TWIModel.sto || _TWIModel_stop_allowed(status), "STOP requested in a state that does not allow it");
+	TWIModel_assert(!_TWIModel.sta || (status != MTR_START && status != MTR_REPSTART && status != MR_SLAR_ACK && status != MR_DATA_ACK), "START requested in a state that does not allow it");
+	TWIModel_assert(_TWIModel.sta || _TWIModel.sto || (status != MR_SLAR_NACK && status != MR_DATA_NACK), "master receiver has nothing left to do but no STOP or START is requested");
+	
+	_TWIModel.flag = 0;
+	_TWIModel.from = status;
+	_TWIModel.pending = 1;
+}
+
+uint8_t _TWIModel_stop_allowed(uint8_t status)
+{
+	switch (status)
+	{
+		case MT_SLAW_ACK:
+		case MT_SLAW_NACK:
+		case MT_DATA_ACK:
+		case MT_DATA_NACK:
+		case MR_SLAR_NACK:
+		case MR_DATA_NACK:
+			return 1;
+		
+		default:
+			return 0;
+	}
+}
+
+void _TWIModel_complete()
+{
+	_TWIModel.pending = 0;
+	
+	uint8_t ea = (_TWIModel.twcr & TWIMODEL_EA) != 0;
+	uint8_t arbitration = TWIModel_multi_master? 1 : 0;
+	
+	switch (_TWIModel.from)
+	{
+		case TWIMODEL_IDLE:
+			TWIModel_bus.length = 0;
+			TWIModel_bus.truncated = 0;
+			_TWIModel_raise(MTR_START);
+			break;
+		
+		//SLA+R/W, another master may win arbitration and address this TWI
+		case MTR_START:
+		case MTR_REPSTART:
+		{
+			uint8_t sla = TWIModel_twdr;
+			uint8_t rw = sla & 1;
+			_TWIModel_record(sla);
+			TWIModel_bus.data = TWIModel_bus.length;
+			
+			uint8_t own = arbitration && ea && (TWAR & 0xFE || TWAR & TWIMODEL_GCE);
+			
+			switch (TWIModel_input() % (own? 5 : 2 + arbitration))
+			{
+				case 0: _TWIModel_raise(rw? MR_SLAR_ACK : MT_SLAW_ACK); break;
+				case 1: _TWIModel_raise(rw? MR_SLAR_NACK : MT_SLAW_NACK); break;
+				case 2: _TWIModel_raise(MTR_ARB_LOST); break;
+				
+				case 3:
+				{
+					uint8_t general_call = (TWAR & TWIMODEL_GCE) && (TWIModel_input() & 1);
+					TWIModel_twdr = _TWIModel_own_address(0, general_call);
+					_TWIModel_raise(general_call? SR_ARB_LOST_GC_ACK : SR_ARB_LOST_SLAW_ACK);
+					break;
+				}
+				
+				default:
+					TWIModel_twdr = _TWIModel_own_address(1, 0);
+					_TWIModel_raise(ST_ARB_LOST_SLAR_ACK);
+					break;
+			}
+			break;
+		}
+		
+		case MT_SLAW_ACK:
+		case MT_SLAW_NACK:
+		case MT_DATA_ACK:
+		case MT_DATA_NACK:
+		case MR_SLAR_NACK:
+		case MR_DATA_NACK:
+			if (_TWIModel.sto)
+			{
+				_TWIModel.twcr &= ~TWIMODEL_STO;
+				_TWIModel_release();
+				
+				if (_TWIModel.sta) _TWIModel_raise(MTR_START);
+			}
+			else if (_TWIModel.sta) _TWIModel_raise(MTR_REPSTART);
+			else
+			{
+				_TWIModel_record(TWIModel_twdr);
+				
+				switch (TWIModel_input() % (2 + arbitration))
+				{
+					case 0: _TWIModel_raise(MT_DATA_ACK); break;
+					case 1: _TWIModel_raise(MT_DATA_NACK); break;
+					default: _TWIModel_raise(MTR_ARB_LOST); break;
+				}
+			}
+			break;
+		
+		//Arbitration can only be lost in the NOT ACK bit of a receiver
+		case MR_SLAR_ACK:
+		case MR_DATA_ACK:
+			TWIModel_twdr = TWIModel_input();
+			_TWIModel_record(TWIModel_twdr);
+			
+			if (ea) _TWIModel_raise(MR_DATA_ACK);
+			else if (arbitration && TWIModel_input() % 4 == 0) _TWIModel_raise(MTR_ARB_LOST);
+			else _TWIModel_raise(MR_DATA_NACK);
+			break;
+		
+		//Bus released, START is sent once the bus is free
+		case MTR_ARB_LOST:
+			_TWIModel_release();
+			if (_TWIModel.sta) _TWIModel_raise(MTR_START);
+			break;
+		
+		//Another master sends data or ends with STOP / repeated START
+		case SR_SLAW_ACK:
+		case SR_ARB_LOST_SLAW_ACK:
+		case SR_DATA_ACK:
+		case SR_GC_ACK:
+		case SR_ARB_LOST_GC_ACK:
+		case SR_GC_DATA_ACK:
+		{
+			uint8_t general_call = _TWIModel.from == SR_GC_ACK || _TWIModel.from == SR_ARB_LOST_GC_ACK || _TWIModel.from == SR_GC_DATA_ACK;
+			
+			if (TWIModel_input() % 8 == 0)
+			{
+				_TWIModel_raise(SR_STOP_REPSTART);
+				break;
+			}
+			
+			TWIModel_twdr = TWIModel_input();
+			
+			if (general_call) _TWIModel_raise(ea? SR_GC_DATA_ACK : SR_GC_DATA_NACK);
+			else _TWIModel_raise(ea? SR_DATA_ACK : SR_DATA_NACK);
+			break;
+		}
+		
+		//Another master reads TWDR and answers with ACK or NOT ACK
+		case ST_SLAR_ACK:
+		case ST_ARB_LOST_SLAR_ACK:
+		case ST_DATA_ACK:
+			if (!(TWIModel_input() & 1)) _TWIModel_raise(ST_DATA_NACK);
+			else _TWIModel_raise(ea? ST_DATA_ACK : ST_DATA_DONE);
+			break;
+		
+		//Not addressed slave mode, TWEA decides whether the own address is recognized again
+		case SR_DATA_NACK:
+		case SR_GC_DATA_NACK:
+		case SR_STOP_REPSTART:
+		case ST_DATA_NACK:
+		case ST_DATA_DONE:
+			TWIModel_assert(ea, "own address recognition left disabled after slave state 0x%02X", _TWIModel.from);
+			
+			_TWIModel_release();
+			if (_TWIModel.sta) _TWIModel_raise(MTR_START);
+			break;
+		
+		default:
+			TWIModel_fail("TWINT cleared in unmodelled state 0x%02X", _TWIModel.from);
+	}
+}
+
+void _TWIModel_interrupt()
+{
+	uint8_t status = _TWIModel.status;
+	
+	//Master routines run with the interrupt disabled, 0x38 is finished by _I2C_m_end
+	TWIModel_assert(status >= SR_SLAW_ACK && status <= ST_DATA_DONE, "master state 0x%02X handed to ISR(TWI_vect)", status);
+	
+	_TWIModel.in_isr = 1;
+	_TWIModel.isr_accesses = 0;
+	
+	TWIModel_isr();
+	
+	_TWIModel.in_isr = 0;
+	
+	TWIModel_assert(_TWIModel.isr_accesses <= TWIMODEL_ISR_ACCESS_MAX, "ISR(TWI_vect) made %u register accesses", _TWIModel.isr_accesses);
+	TWIModel_assert(!_TWIModel.flag || !(_TWIModel.twcr & TWIMODEL_INTEN), "ISR(TWI_vect) returned without clearing TWINT");
+}
+
+void _TWIModel_raise(uint8_t status)
+{
+	#ifdef TWIMODEL_TRACE
+		fprintf(stderr, "TWI model: 0x%02X -> 0x%02X, TWDR 0x%02X\n", _TWIModel.status, status, TWIModel_twdr);
+	#endif
+	
+	if (status == SR_SLAW_ACK || status == SR_ARB_LOST_SLAW_ACK || status == SR_GC_ACK || status == SR_ARB_LOST_GC_ACK) TWIModel_slave_acked = 0;
+	if (status == SR_DATA_ACK || status == SR_GC_DATA_ACK) TWIModel_slave_acked++;
+	
+	_TWIModel.status = status;
+	_TWIModel.flag = 1;
+	TWIModel_twsr = (TWIModel_twsr & 0x03) | status;
+}
+
+void _TWIModel_release()
+{
+	_TWIModel.status = TWIMODEL_IDLE;
+	_TWIModel.flag = 0;
+	TWIModel_twsr = (TWIModel_twsr & 0x03) | TWIMODEL_IDLE;
+}
+
+void _TWIModel_record(uint8_t value)
+{
+	if (TWIModel_bus.length < TWIMODEL_BUS_MAX) TWIModel_bus.bytes[TWIModel_bus.length++] = value;
+	else TWIModel_bus.truncated = 1;
+}
+
+//SLA+R/W of another master that matches TWAR under the TWAMR mask
+uint8_t _TWIModel_own_address(uint8_t rw, uint8_t general_call)
+{
+	if (general_call) return 0;
+	
+	uint8_t mask = TWAMR >> 1;
+	uint8_t address = ((TWAR >> 1) & ~mask) | (TWIModel_input() & mask);
+	
+	return (address << 1) | rw;
+}
+
+void TWIModel_address()
+{
+	if (!_TWIModel.attached || _TWIModel.flag || _TWIModel.pending || _TWIModel.status != TWIMODEL_IDLE) return;
+	if (!(_TWIModel.twcr & TWIMODEL_EN) || !(_TWIModel.twcr & TWIMODEL_EA)) return;
+	if (!(TWAR & 0xFE) && !(TWAR & TWIMODEL_GCE)) return;
+	
+	switch (TWIModel_input() % 3)
+	{
+		case 0:
+			TWIModel_twdr = _TWIModel_own_address(0, 0);
+			_TWIModel_raise(SR_SLAW_ACK);
+			break;
+		
+		case 1:
+			TWIModel_twdr = _TWIModel_own_address(1, 0);
+			_TWIModel_raise(ST_SLAR_ACK);
+			break;
+		
+		default:
+			if (!(TWAR & TWIMODEL_GCE)) return;
+			
+			TWIModel_twdr = 0;
+			_TWIModel_raise(SR_GC_ACK);
+			break;
+	}
+}
+
+void TWIModel_run()
+{
+	while (_TWIModel.attached && (_TWIModel.pending || (_TWIModel.flag && (_TWIModel.twcr & TWIMODEL_INTEN) && TWIModel_sreg_i))) _TWIModel_tick();
+}
+
+uint8_t TWIModel_idle() {return !_TWIModel.flag && !_TWIModel.pending && _TWIModel.status == TWIMODEL_IDLE;}
+
+uint8_t TWIModel_peek() {return _TWIModel.twcr | (_TWIModel.flag? TWIMODEL_INT : 0);}
+
+void TWIModel_sleep()
+{
+	TWIModel_assert(TWIModel_sleep_enabled, "sleep_cpu without sleep_enable");
+	TWIModel_assert(TWIModel_sreg_i, "sleeping with interrupts disabled");
+	
+	uint8_t power_down = TWIModel_sleep_mode == SLEEP_MODE_PWR_DOWN;
+	
+	//The TWI has no clock in power-down, a byte in progress is lost
+	TWIModel_assert(!power_down || _TWIModel.flag || (!_TWIModel.pending && _TWIModel.status == TWIMODEL_IDLE), "power-down in the middle of a transaction");
+	
+	if (!_TWIModel.flag)
+	{
+		TWIModel_assert(_TWIModel.twcr & TWIMODEL_EA, "sleeping without own address recognition");
+		
+		TWIModel_address();
+		
+		//TWDR is not updated by an address match in power-down
+		if (power_down && _TWIModel.flag) TWIModel_twdr = TWIModel_input();
+	}
+	
+	_TWIModel_tick();
+}
+
+//Builds without a slave slice have no ISR(TWI_vect), the vector would jump to the reset handler
+__attribute__((weak)) void TWIModel_isr(void)
+{
+	TWIModel_fail("TWI interrupt taken without ISR(TWI_vect)");
+}
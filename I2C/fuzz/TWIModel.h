@@ -0,0 +1,95 @@
+#ifndef TWIMODEL_H_
+#define TWIMODEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+//Register-level model of the ATmega328P TWI for host builds of I2C.c
+//Bus responses (status codes, received bytes, other masters) are taken from the fuzz input
+//Violations of the datasheet state tables end the run through TWIModel_fail
+
+//Register accesses allowed in one ISR(TWI_vect) run
+#ifndef TWIMODEL_ISR_ACCESS_MAX
+	#define TWIMODEL_ISR_ACCESS_MAX 16
+#endif
+
+//Consecutive TWCR reads with no bus action in progress, more means a wait loop that never ends
+#ifndef TWIMODEL_POLL_MAX
+	#define TWIMODEL_POLL_MAX 64
+#endif
+
+//Bytes kept of the current master transaction, see TWIModel_bus
+#define TWIMODEL_BUS_MAX 512
+
+#define TWIMODEL_IDLE 0xF8
+
+//TWCR bits, same layout as TWCR_* in I2C.c
+#define TWIMODEL_INT 0x80
+#define TWIMODEL_EA 0x40
+#define TWIMODEL_STA 0x20
+#define TWIMODEL_STO 0x10
+#define TWIMODEL_EN 0x04
+#define TWIMODEL_INTEN 0x01
+
+#define TWIMODEL_GCE 0x01
+
+#define TWIModel_assert(condition, ...) do {if (!(condition)) TWIModel_fail(__VA_ARGS__);} while(0)
+
+extern volatile uint8_t TWIModel_twsr;
+extern volatile uint8_t TWIModel_twdr;
+extern volatile uint8_t TWIModel_sreg_i;
+extern volatile uint8_t TWIModel_sleep_mode;
+extern volatile uint8_t TWIModel_sleep_enabled;
+
+//Other masters may win arbitration, set for MULTI_MASTER configurations
+extern uint8_t TWIModel_multi_master;
+
+//Bytes of the last master transaction from START to STOP: SLA+R/W, data, PEC
+typedef struct TWIModelBus{
+	uint8_t bytes[TWIMODEL_BUS_MAX];
+	uint16_t length;
+	uint16_t data; //Index of the first byte after the last SLA+R/W
+	uint8_t truncated;
+} TWIModelBus;
+
+extern TWIModelBus TWIModel_bus;
+
+//Data bytes acknowledged as slave receiver since the own address matched
+extern uint16_t TWIModel_slave_acked;
+
+//Jumped to when the input is used up, the scenario ends there
+extern jmp_buf TWIModel_end;
+
+void TWIModel_attach(const uint8_t* data, size_t size);
+void TWIModel_detach();
+
+//Next input byte, jumps to TWIModel_end when there is none left
+uint8_t TWIModel_input();
+
+//Register access (see fuzz/avr/io.h)
+uint8_t TWIModel_read();
+void TWIModel_write(uint8_t value);
+volatile uint8_t* TWIModel_access(volatile uint8_t* reg);
+
+//Another master addresses the TWI if it is idle and recognizes its own address
+void TWIModel_address();
+
+//Lets the bus run until no action is pending and no interrupt can be dispatched
+void TWIModel_run();
+
+//Bus released and no state pending
+uint8_t TWIModel_idle();
+
+//TWCR without counting as a register access
+uint8_t TWIModel_peek();
+
+//sleep_cpu(), wakes on an address match or another interrupt
+void TWIModel_sleep();
+
+//ISR(TWI_vect) of I2C.c, builds without a slave slice must never enable the TWI interrupt
+void TWIModel_isr(void);
+
+void TWIModel_fail(const char* format, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef FUZZ_AVR_INTERRUPT_H_
+#define FUZZ_AVR_INTERRUPT_H_
+
+#include "../TWIModel.h"
+
+#define ISR(vector) void vector(void)
+
+//Global interrupt flag, the model only dispatches TWI_vect while it is set
+#define sei() (TWIModel_sreg_i = 1)
+#define cli() (TWIModel_sreg_i = 0)
+
+#endif
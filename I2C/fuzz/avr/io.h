@@ -0,0 +1,20 @@
+#ifndef FUZZ_AVR_IO_H_
+#define FUZZ_AVR_IO_H_
+
+//Host stand-in for <avr/io.h>, the TWI registers are served by the model in TWIModel.c
+#include "../TWIModel.h"
+
+//TWCR is read through the model, writes are rewritten into TWIModel_write by the Makefile
+#define TWCR (TWIModel_read())
+#define TWSR (*TWIModel_access(&TWIModel_twsr))
+#define TWDR (*TWIModel_access(&TWIModel_twdr))
+
+extern volatile uint8_t TWBR;
+extern volatile uint8_t TWAR;
+extern volatile uint8_t TWAMR;
+extern volatile uint8_t PORTC;
+extern volatile uint16_t TCNT1;
+
+#define TWI_vect TWIModel_isr
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef FUZZ_AVR_PGMSPACE_H_
+#define FUZZ_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+
+#endif
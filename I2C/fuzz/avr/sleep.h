@@ -0,0 +1,16 @@
+#ifndef FUZZ_AVR_SLEEP_H_
+#define FUZZ_AVR_SLEEP_H_
+
+#include "../TWIModel.h"
+
+#define SLEEP_MODE_IDLE 0x00
+#define SLEEP_MODE_PWR_DOWN 0x04
+
+#define set_sleep_mode(mode) (TWIModel_sleep_mode = (mode))
+#define sleep_enable() (TWIModel_sleep_enabled = 1)
+#define sleep_disable() (TWIModel_sleep_enabled = 0)
+
+//The model decides whether an address match ends the sleep
+#define sleep_cpu() TWIModel_sleep()
+
+#endif
@@ -0,0 +1,39 @@
+#!/bin/sh
+#Compiles I2C.c and I2CProtocol.c once per feature profile and prints .text/.data/.bss of both objects together
+#Usage: ./size_report.sh [mcu]
+#Toolchain can be overridden with CC and SIZE
+
+MCU=${1:-atmega328p}
+CC=${CC:-avr-gcc}
+SIZE=${SIZE:-avr-size}
+
+#Same code generation options as the Release configuration in I2C.cproj
+CFLAGS="-mmcu=$MCU -Os -funsigned-char -funsigned-bitfields -fpack-struct -fshort-enums -Wall"
+
+cd "$(dirname "$0")" || exit 1
+OUT=$(mktemp -d) || exit 1
+trap 'rm -rf "$OUT"' EXIT
+
+printf "%-24s %7s %7s %7s\n" profile .text .data .bss
+
+while read -r name flags
+do
+	[ -z "$name" ] && continue
+	
+	$CC $CFLAGS $flags -c I2C.c -o "$OUT/$name.o" || exit 1
+	$CC $CFLAGS $flags -c I2CProtocol.c -o "$OUT/${name}_protocol.o" || exit 1
+	$SIZE -t "$OUT/$name.o" "$OUT/${name}_protocol.o" | awk -v name="$name" '/TOTALS/ {printf "%-24s %7s %7s %7s\n", name, $1, $2, $3}'
+done <<PROFILES
+full
+full_stats -DI2C_FEATURE_STATS
+full_trace -DI2C_FEATURE_TRACE
+master -DI2C_MINIMAL -DI2C_FEATURE_MASTER
+master_fixed_frequency -DI2C_MINIMAL -DI2C_FEATURE_MASTER -DI2C_FREQUENCY=100000UL
+master_terminator -DI2C_MINIMAL -DI2C_FEATURE_MASTER -DI2C_FEATURE_TERMINATOR
+master_stats -DI2C_MINIMAL -DI2C_FEATURE_MASTER -DI2C_FEATURE_STATS
+multi_master -DI2C_MINIMAL -DI2C_FEATURE_MASTER -DI2C_FEATURE_MULTI_MASTER
+slave_rx -DI2C_MINIMAL -DI2C_FEATURE_SLAVE_RX
+slave_rx_no_heap -DI2C_MINIMAL -DI2C_FEATURE_SLAVE_RX -DI2C_STREAM_MODE
+slave_tx -DI2C_MINIMAL -DI2C_FEATURE_SLAVE_TX
+slave_low_power -DI2C_MINIMAL -DI2C_FEATURE_SLAVE_RX -DI2C_FEATURE_LOW_POWER
+PROFILES
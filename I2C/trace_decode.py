@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Decodes an I2C_trace_dump into a readable timeline.
+
+Input is the dumped I2CTraceEntry array as hex bytes (whitespace separated,
+optional 0x prefix), 4 bytes per entry: status, data, tick low, tick high.
+
+Usage: trace_decode.py [file] [--tick-us N]
+"""
+
+import argparse
+import sys
+
+STATES = {
+    0x08: "MTR_START",
+    0x10: "MTR_REPSTART",
+    0x38: "MTR_ARB_LOST",
+    0x18: "MT_SLAW_ACK",
+    0x20: "MT_SLAW_NACK",
+    0x28: "MT_DATA_ACK",
+    0x30: "MT_DATA_NACK",
+    0x40: "MR_SLAR_ACK",
+    0x48: "MR_SLAR_NACK",
+    0x50: "MR_DATA_ACK",
+    0x58: "MR_DATA_NACK",
+    0x60: "SR_SLAW_ACK",
+    0x68: "SR_ARB_LOST_SLAW_ACK",
+    0x70: "SR_GC_ACK",
+    0x78: "SR_ARB_LOST_GC_ACK",
+    0x80: "SR_DATA_ACK",
+    0x88: "SR_DATA_NACK",
+    0x90: "SR_GC_DATA_ACK",
+    0x98: "SR_GC_DATA_NACK",
+    0xA0: "SR_STOP_REPSTART",
+    0xA8: "ST_SLAR_ACK",
+    0xB0: "ST_ARB_LOST_SLAR_ACK",
+    0xB8: "ST_DATA_ACK",
+    0xC0: "ST_DATA_NACK",
+    0xC8: "ST_DATA_DONE",
+    0xF8: "M_NO_INFO",
+    0x00: "M_ERR_ILLEGAL_START_STOP",
+}
+
+#States that carry an address byte in TWDR
+ADDRESS_STATES = {0x18, 0x20, 0x40, 0x48, 0x60, 0x68, 0xA8, 0xB0}
+
+#States worth flagging in the timeline
+ERROR_STATES = {0x20, 0x30, 0x38, 0x48, 0x00}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", nargs="?", help="dump file (default: stdin)")
+    parser.add_argument("--tick-us", type=float, default=None, help="microseconds per tick")
+    args = parser.parse_args()
+
+    text = open(args.file).read() if args.file else sys.stdin.read()
+    data = [int(token, 16) for token in text.split()]
+
+    if len(data) % 4:
+        sys.exit("dump length %d is not a multiple of 4" % len(data))
+
+    elapsed = 0
+    previous = None
+
+    for i in range(0, len(data), 4):
+        status, value, tick = data[i], data[i + 1], data[i + 2] | (data[i + 3] << 8)
+
+        if previous is not None: elapsed += (tick - previous) & 0xFFFF
+        previous = tick
+
+        time = "%10.1fus" % (elapsed * args.tick_us) if args.tick_us else "%10d" % elapsed
+        name = STATES.get(status, "UNKNOWN_0x%02X" % status)
+
+        if status in ADDRESS_STATES: detail = "addr 0x%02X %s" % (value >> 1, "R" if value & 1 else "W")
+        else: detail = "data 0x%02X" % value
+
+        print("%s  %-26s %s%s" % (time, name, detail, "  <--" if status in ERROR_STATES else ""))
+
+
+if __name__ == "__main__":
+    main()
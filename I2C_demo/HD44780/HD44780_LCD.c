@@ -4,9 +4,21 @@
 
 #define LCD_DELAY 1500u
 
+#ifdef LCD_ASYNC_MODE
+	#include <avr/interrupt.h>
+	
+	//Datasheet minimum: 37us per command, 1.52ms for clear display and return home
+	#define LCD_TICK_US 40u
+	#define LCD_LONG_TICKS (1600u / LCD_TICK_US)
+	
+	//TIMER2 in CTC mode, prescaler 8
+	#define LCD_TIMER_OCR ((F_CPU / 8 * LCD_TICK_US / 1000000u) - 1)
+#endif
+
 void clear_data_pins();
 uint8_t my_log2(uint8_t x);
 void write_value(uint8_t value, uint8_t rs_value);
+void write_nibble(uint8_t nibble);
 void init_linear();
 void init_nonlinear();
 uint8_t verify_config();
@@ -18,6 +30,18 @@ uint8_t _display_on = 0;
 uint8_t _two_line = 1;
 PinConfig* _config;
 
+#ifdef LCD_ASYNC_MODE
+	void init_timer();
+	void enqueue_value(uint8_t value, uint8_t rs_value);
+	
+	volatile uint8_t _queue_value[LCD_QUEUE_SIZE];
+	volatile uint8_t _queue_rs[LCD_QUEUE_SIZE];
+	volatile uint8_t _queue_head = 0; //written only by enqueue_value
+	volatile uint8_t _queue_tail = 0; //written only by the timer ISR
+	volatile uint8_t _wait_ticks = 0;
+	volatile uint8_t _low_nibble_pending = 0;
+#endif
+
 int lcd_init(PinConfig* config)
 {
 	_config = config;
@@ -45,6 +69,10 @@ int lcd_init(PinConfig* config)
 	}
 	else return 1;
 	
+	#ifdef LCD_ASYNC_MODE
+		init_timer();
+	#endif
+	
 	//display config
 	lcd_command(_two_line? 0x2C : 0x24);
 	lcd_command(0x06);
@@ -94,24 +122,12 @@ uint8_t my_log2(uint8_t x)
 
 void write_value(uint8_t value, uint8_t rs_value)
 {
-	clear_data_pins();
-	
 	if (rs_value) *(_config -> port) |= _config -> rs;
 	
-	*(_config -> port) |= value & 0x80? _config -> d3 : 0;
-	*(_config -> port) |= value & 0x40? _config -> d2 : 0;
-	*(_config -> port) |= value & 0x20? _config -> d1 : 0;
-	*(_config -> port) |= value & 0x10? _config -> d0 : 0;
-	
+	write_nibble(value >> 4);
 	lcd_pulse_en();
 	
-	clear_data_pins();
-	
-	*(_config -> port) |= value & 0x08? _config -> d3 : 0;
-	*(_config -> port) |= value & 0x04? _config -> d2 : 0;
-	*(_config -> port) |= value & 0x02? _config -> d1 : 0;
-	*(_config -> port) |= value & 0x01? _config -> d0 : 0;
-	
+	write_nibble(value);
 	lcd_pulse_en();
 	
 	*(_config -> port) &= ~_config -> rs;
@@ -119,14 +135,33 @@ void write_value(uint8_t value, uint8_t rs_value)
 	clear_data_pins();
 }
 
+//Loads lower 4 bits of nibble onto the data pins
+void write_nibble(uint8_t nibble)
+{
+	clear_data_pins();
+	
+	*(_config -> port) |= nibble & 0x08? _config -> d3 : 0;
+	*(_config -> port) |= nibble & 0x04? _config -> d2 : 0;
+	*(_config -> port) |= nibble & 0x02? _config -> d1 : 0;
+	*(_config -> port) |= nibble & 0x01? _config -> d0 : 0;
+}
+
 void lcd_command(uint8_t command)
 {
-	write_value(command, 0);
+	#ifdef LCD_ASYNC_MODE
+		enqueue_value(command, 0);
+	#else
+		write_value(command, 0);
+	#endif
 }
 
 void lcd_write_char(char character)
 {
-	write_value(character, 1);
+	#ifdef LCD_ASYNC_MODE
+		enqueue_value(character, 1);
+	#else
+		write_value(character, 1);
+	#endif
 }
 
 void lcd_write_string(char* string, unsigned long length)
@@ -202,6 +237,87 @@ void lcd_off()
 void lcd_home()
 {
 	lcd_command(2);
-	//this operation requires 1.52ms delay
-	_delay_us(1600 - LCD_DELAY);
-}
\ No newline at end of file
+	
+	#ifndef LCD_ASYNC_MODE
+		//this operation requires 1.52ms delay
+		//(in async mode the timer ISR waits LCD_LONG_TICKS instead)
+		_delay_us(1600 - LCD_DELAY);
+	#endif
+}
+
+#ifdef LCD_ASYNC_MODE
+void init_timer()
+{
+	TCCR2A = 0;
+	TCCR2B = 0;
+	TCNT2 = 0;
+	
+	OCR2A = LCD_TIMER_OCR;
+	
+	//CTC mode, prescaler 8
+	TCCR2A |= (1 << WGM21);
+	TCCR2B |= (1 << CS21);
+	
+	//Compare match interrupt is enabled by enqueue_value
+}
+
+//Blocks only while the queue is full
+void enqueue_value(uint8_t value, uint8_t rs_value)
+{
+	uint8_t next = (_queue_head + 1) & (LCD_QUEUE_SIZE - 1);
+	while (next == _queue_tail);
+	
+	_queue_value[_queue_head] = value;
+	_queue_rs[_queue_head] = rs_value;
+	_queue_head = next;
+	
+	//ISR disables itself once the queue has drained
+	TIMSK2 |= (1 << OCIE2A);
+}
+
+uint8_t lcd_queue_empty() {return _queue_head == _queue_tail && !_wait_ticks;}
+void lcd_flush() {while (!lcd_queue_empty());}
+
+//Clocks out one nibble per tick
+ISR(TIMER2_COMPA_vect)
+{
+	if (_wait_ticks)
+	{
+		_wait_ticks--;
+		return;
+	}
+	
+	//Nothing left to clock out, stay off until enqueue_value
+	if (_queue_head == _queue_tail)
+	{
+		TIMSK2 &= ~(1 << OCIE2A);
+		return;
+	}
+	
+	uint8_t value = _queue_value[_queue_tail];
+	uint8_t rs_value = _queue_rs[_queue_tail];
+	
+	if (rs_value) *(_config -> port) |= _config -> rs;
+	else *(_config -> port) &= ~_config -> rs;
+	
+	write_nibble(_low_nibble_pending? value : value >> 4);
+	
+	//Enable pulse width only needs to be 450ns
+	*(_config -> port) |= _config -> en;
+	_delay_us(1);
+	*(_config -> port) &= ~_config -> en;
+	
+	if (!_low_nibble_pending)
+	{
+		_low_nibble_pending = 1;
+		return;
+	}
+	
+	_low_nibble_pending = 0;
+	
+	//Clear display (0x01) and return home (0x02/0x03) require 1.52ms
+	if (!rs_value && value < 4) _wait_ticks = LCD_LONG_TICKS;
+	
+	_queue_tail = (_queue_tail + 1) & (LCD_QUEUE_SIZE - 1);
+}
+#endif
\ No newline at end of file
@@ -7,6 +7,14 @@
 	#define F_CPU 16000000u
 #endif
 
+//Define LCD_ASYNC_MODE to queue commands and characters into a ring buffer
+//which is clocked out from the TIMER2 compare interrupt (global interrupts must be enabled)
+#ifdef LCD_ASYNC_MODE
+	#ifndef LCD_QUEUE_SIZE
+		#define LCD_QUEUE_SIZE 32 //must be a power of 2
+	#endif
+#endif
+
 typedef struct PinConfig{
 	uint8_t* ddr;
 	uint8_t* port;
@@ -31,4 +39,9 @@ void lcd_hide_cusror();
 void lcd_on();
 void lcd_off();
 void lcd_home();
+
+#ifdef LCD_ASYNC_MODE
+	uint8_t lcd_queue_empty();
+	void lcd_flush();
+#endif
 #endif
\ No newline at end of file
@@ -1,115 +1,403 @@
 #include <Arduino.h>
+
+#ifdef VALIDATOR_BENCHMARK
+extern "C" {
+  #include "I2C.h"
+  #include "I2CSoft.h"
+}
+
+#define BUFFER_LENGTH 32
+#else
 #include <Wire.h>
+#endif
+
+//Soak/benchmark peer for the I2C library.
+//
+//Frame layout (identical in both directions, no byte can equal TERMINATOR):
+//  [0x80 | seq] [len] [payload x len] [0xF0 | crc >> 4] [0xF0 | crc & 0x0F] ([TERMINATOR])
+//  - payload bytes are xorshift8 output seeded from seq, never 0x00
+//  - len = 1 + (seed(seq) % MAX_PAYLOAD), so both peers know the frame size in advance
+//  - crc is CRC-8 (poly 0x07) over seq, len and payload
+//  - frames ending in TERMINATOR were sent in terminator mode
+//
+//Every REPORT_INTERVAL_MS one summary line is printed:
+//  S <seconds> <tx frames> <rx frames> <bytes/s> <crc errors> <pattern errors> <nacks> H <latency histogram>
+//Histogram bucket i counts transactions that took [2^i, 2^(i+1)) us (slave: time between frames).
+//
+//Define VALIDATOR_MASTER to drive the bus (cycling BUS_FREQUENCIES) against a DUT running the
+//library as slave on DUT_ADDRESS. Otherwise the validator is a slave on SLAVE_ADDRESS.
+//
+//Define VALIDATOR_BENCHMARK to run the library itself as master against a second validator in
+//slave mode, once with the TWI and once with the software backend (I2CSoft, PB0 = SDA, PB1 = SCL,
+//wire D8 to A4 and D9 to A5). Both write BENCHMARK_FRAMES frames at I2C_SOFT_FREQUENCY, the slave
+//verifies them. Every REPORT_INTERVAL_MS one line per backend is printed:
+//  B <backend> <frames> <errors> <us> <bytes/s> <effective SCL Hz> <clock stretches>
+//followed by the I2C_SOFT_OVERHEAD that would make the software SCL match I2C_SOFT_FREQUENCY:
+//  O <current> <suggested>
 
 #define TERMINATOR 0x0
+#define SLAVE_ADDRESS 0x0F
+#define DUT_ADDRESS 0x0F
+#define MAX_PAYLOAD 27 //Wire buffer is 32 bytes: 2 header + 27 payload + 2 crc + terminator
+#define REPORT_INTERVAL_MS 10000
+#define HISTOGRAM_BUCKETS 16
+#define FRAMES_PER_FREQUENCY 1000
+#define BENCHMARK_FRAMES 200
+
+const uint32_t BUS_FREQUENCIES[] = {100000, 400000, 50000, 200000};
 
-void realloc_buffer();
+struct SoakStats
+{
+  uint32_t tx_frames;
+  uint32_t rx_frames;
+  uint32_t bytes;
+  uint32_t crc_errors;
+  uint32_t pattern_errors;
+  uint32_t nacks;
+  uint32_t histogram[HISTOGRAM_BUCKETS];
+};
+
+uint8_t crc8_update(uint8_t crc, uint8_t data);
+uint8_t payload_seed(uint8_t seq);
+uint8_t payload_length(uint8_t seq);
+uint8_t build_frame(uint8_t seq, uint8_t* frame, bool terminator);
+bool verify_frame(const uint8_t* frame, uint8_t count);
+void record_latency(uint32_t us);
+void report();
 void on_data_received(int count);
 void on_data_requested();
-void serial_write_data(uint8_t count);
-void on_data_received_terminator(int count);
-void serial_write_data_terminator(uint8_t terminator);
-void on_data_requested_terminator();
 
-uint8_t* buffer = NULL;
+#ifdef VALIDATOR_BENCHMARK
+typedef enum I2CTransmissionResult (*BenchmarkTransmit)(I2CMasterTransmission* transmission);
 
-void setup() 
-{
-  buffer = (uint8_t*)malloc(0xFF);
+uint32_t benchmark(const char* name, BenchmarkTransmit transmit, uint32_t* clocks);
+
+I2CConfig benchmark_config;
+#endif
+
+uint8_t buffer[BUFFER_LENGTH];
+volatile SoakStats stats;
+uint8_t tx_seq = 0;
+uint32_t last_report = 0;
+uint32_t bytes_at_last_report = 0;
+
+#if defined(VALIDATOR_BENCHMARK)
+#elif !defined(VALIDATOR_MASTER)
+volatile uint32_t last_frame_us = 0;
+#else
+uint8_t frequency_index = 0;
+uint32_t frames_at_frequency = 0;
+#endif
 
-  Serial.begin(9600);
-  Wire.begin(0x0F);
+void setup()
+{
+  Serial.begin(115200);
 
-  Wire.onReceive(on_data_received_terminator);
-  Wire.onRequest(on_data_requested_terminator);
+#if defined(VALIDATOR_BENCHMARK)
+  benchmark_config.frequency = I2C_SOFT_FREQUENCY;
+  benchmark_config.mode = MASTER;
+  I2C_init(&benchmark_config);
+#elif defined(VALIDATOR_MASTER)
+  Wire.begin();
+  Wire.setClock(BUS_FREQUENCIES[0]);
+#else
+  Wire.begin(SLAVE_ADDRESS);
+  Wire.onReceive(on_data_received);
+  Wire.onRequest(on_data_requested);
+#endif
 
   pinMode(13, OUTPUT);
-  Serial.println("test");
+  Serial.println("soak");
 }
 
-void loop() 
+void loop()
 {
-  
+#ifdef VALIDATOR_BENCHMARK
+  uint8_t seq = tx_seq;
+  uint32_t clocks;
+
+  //TWI pins are released while the software backend drives the same bus
+  I2C_enable();
+  benchmark("twi", I2C_start_transmission, &clocks);
+  I2C_disable();
+
+  //Same frames for both backends
+  tx_seq = seq;
+  I2CSoft_init();
+  uint32_t soft_us = benchmark("soft", I2CSoft_start_transmission, &clocks);
+
+  //Time above the nominal SCL is spread over the half bits, per-transaction overhead included
+  int32_t half_cycles = (int32_t)((uint64_t)soft_us * (F_CPU / 1000000UL) / (2 * clocks));
+  int32_t nominal_half_cycles = F_CPU / (2UL * I2C_SOFT_FREQUENCY);
+
+  Serial.print("O ");
+  Serial.print(I2C_SOFT_OVERHEAD);
+  Serial.print(' ');
+  Serial.println(I2C_SOFT_OVERHEAD + half_cycles - nominal_half_cycles);
+
+  delay(REPORT_INTERVAL_MS);
+  return;
+#endif
+
+#ifdef VALIDATOR_MASTER
+  uint8_t frame[BUFFER_LENGTH];
+  bool terminator = tx_seq & 1;
+  uint8_t length = build_frame(tx_seq, frame, terminator);
+
+  //Master -> DUT
+  uint32_t start = micros();
+  Wire.beginTransmission(DUT_ADDRESS);
+  Wire.write(frame, length);
+  uint8_t result = Wire.endTransmission();
+  record_latency(micros() - start);
+
+  if (result == 0)
+  {
+    stats.tx_frames++;
+    stats.bytes += length;
+  }
+  else if (result == 2 || result == 3) stats.nacks++;
+
+  //DUT -> Master, DUT answers with the frame for the same seq in the same mode
+  start = micros();
+  uint8_t count = Wire.requestFrom((uint8_t)DUT_ADDRESS, length);
+  record_latency(micros() - start);
+
+  if (count != length) stats.nacks++;
+  else
+  {
+    Wire.readBytes(buffer, count);
+    if (verify_frame(buffer, count)) stats.rx_frames++;
+    stats.bytes += count;
+  }
+
+  tx_seq++;
+
+  if (++frames_at_frequency >= FRAMES_PER_FREQUENCY)
+  {
+    frames_at_frequency = 0;
+    frequency_index = (frequency_index + 1) % (sizeof(BUS_FREQUENCIES) / sizeof(BUS_FREQUENCIES[0]));
+    Wire.setClock(BUS_FREQUENCIES[frequency_index]);
+  }
+#endif
+
+  if (millis() - last_report >= REPORT_INTERVAL_MS) report();
 }
 
-void on_data_received(int count)
+//CRC-8, polynomial 0x07
+uint8_t crc8_update(uint8_t crc, uint8_t data)
 {
-  Wire.readBytes(buffer, count);
+  crc ^= data;
 
-  serial_write_data((uint8_t)count);
+  for (uint8_t i = 0; i < 8; i++) crc = crc & 0x80? (crc << 1) ^ 0x07 : crc << 1;
 
-  digitalWrite(13, 1);
+  return crc;
 }
 
-void on_data_requested()
+uint8_t payload_seed(uint8_t seq)
+{
+  //xorshift8 state must never be 0
+  uint8_t seed = (seq & 0x7F) * 37 + 11;
+  return seed? seed : 1;
+}
+
+uint8_t payload_length(uint8_t seq)
+{
+  return 1 + payload_seed(seq) % MAX_PAYLOAD;
+}
+
+//Returns total frame length
+uint8_t build_frame(uint8_t seq, uint8_t* frame, bool terminator)
 {
-  Serial.println("Data requested");
+  uint8_t length = payload_length(seq);
+  uint8_t state = payload_seed(seq);
+  uint8_t i = 0;
+
+  frame[i++] = 0x80 | seq;
+  frame[i++] = length;
+
+  for (uint8_t j = 0; j < length; j++)
+  {
+    state ^= state << 3;
+    state ^= state >> 5;
+    state ^= state << 1;
+    frame[i++] = state? state : 0xFF;
+  }
+
+  uint8_t crc = 0;
+  for (uint8_t j = 0; j < i; j++) crc = crc8_update(crc, frame[j]);
+
+  frame[i++] = 0xF0 | (crc >> 4);
+  frame[i++] = 0xF0 | (crc & 0x0F);
 
-  Wire.write("Hello world!", 12);
+  if (terminator) frame[i++] = TERMINATOR;
 
-  digitalWrite(13, 1);
+  return i;
 }
 
-void on_data_received_terminator(int count)
+bool verify_frame(const uint8_t* frame, uint8_t count)
 {
-  Wire.readBytesUntil(TERMINATOR, buffer, count);
+  bool terminator = count && frame[count - 1] == TERMINATOR;
+  if (terminator) count--;
+
+  if (count < 5 || !(frame[0] & 0x80) || frame[1] + 4 != count)
+  {
+    stats.pattern_errors++;
+    return false;
+  }
+
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < count - 2; i++) crc = crc8_update(crc, frame[i]);
+
+  if (frame[count - 2] != (0xF0 | (crc >> 4)) || frame[count - 1] != (0xF0 | (crc & 0x0F)))
+  {
+    stats.crc_errors++;
+    return false;
+  }
+
+  uint8_t expected[BUFFER_LENGTH];
+  build_frame(frame[0] & 0x7F, expected, false);
 
-  serial_write_data_terminator(TERMINATOR);
+  if (memcmp(frame, expected, count))
+  {
+    stats.pattern_errors++;
+    return false;
+  }
 
-  digitalWrite(13, 1);
+  return true;
 }
 
-void on_data_requested_terminator()
+void record_latency(uint32_t us)
 {
-  Serial.println("Data requested");
-  
-  //char* tx_buffer = (char*)malloc(14);
-  //strcpy(tx_buffer, "Hello World!");
-  //tx_buffer[13] = TERMINATOR;
-  
-  Wire.write("Hello world!", 13);
-
-  digitalWrite(13, 1);
+  uint8_t bucket = 0;
+  while (us > 1 && bucket < HISTOGRAM_BUCKETS - 1)
+  {
+    us >>= 1;
+    bucket++;
+  }
+
+  stats.histogram[bucket]++;
 }
 
-void serial_write_data(uint8_t count)
+void report()
 {
-  Serial.println("#: T | BBBBBBBB | HH | DEC");
+  SoakStats snapshot;
+
+  noInterrupts();
+  memcpy(&snapshot, (const void*)&stats, sizeof(SoakStats));
+  interrupts();
 
-  for (uint8_t i = 0; i < count; i++)
+  uint32_t now = millis();
+
+  Serial.print("S ");
+  Serial.print(now / 1000);
+  Serial.print(' ');
+  Serial.print(snapshot.tx_frames);
+  Serial.print(' ');
+  Serial.print(snapshot.rx_frames);
+  Serial.print(' ');
+  Serial.print((snapshot.bytes - bytes_at_last_report) * 1000 / (now - last_report));
+  Serial.print(' ');
+  Serial.print(snapshot.crc_errors);
+  Serial.print(' ');
+  Serial.print(snapshot.pattern_errors);
+  Serial.print(' ');
+  Serial.print(snapshot.nacks);
+  Serial.print(" H");
+
+  for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++)
   {
-    Serial.print(i, DEC);
-    Serial.print(": ");
-    Serial.print((char)buffer[i]);
-    Serial.print(" | ");
-    Serial.print(buffer[i], BIN);
-    Serial.print(" | ");
-    Serial.print(buffer[i], HEX);
-    Serial.print(" | ");
-    Serial.println(buffer[i], DEC);
+    Serial.print(' ');
+    Serial.print(snapshot.histogram[i]);
   }
 
-  Serial.println("--------------------------");
+  Serial.println();
+
+  bytes_at_last_report = snapshot.bytes;
+  last_report = now;
 }
 
-void serial_write_data_terminator(uint8_t terminator)
+#ifdef VALIDATOR_BENCHMARK
+//Returns total bus time in us, clocks: SCL clocks of all frames
+uint32_t benchmark(const char* name, BenchmarkTransmit transmit, uint32_t* clocks)
 {
-  Serial.println("#: T | BBBBBBBB | HH | DEC");
+  uint32_t total_us = 0;
+  uint32_t bytes = 0;
+  uint16_t errors = 0;
+  uint16_t stretches = I2CSoft_stretch_count;
 
-  for (uint8_t i = 0; true; i++)
+  *clocks = 0;
+
+  for (uint16_t i = 0; i < BENCHMARK_FRAMES; i++)
   {
-    Serial.print(i, DEC);
-    Serial.print(": ");
-    Serial.print((char)buffer[i]);
-    Serial.print(" | ");
-    Serial.print(buffer[i], BIN);
-    Serial.print(" | ");
-    Serial.print(buffer[i], HEX);
-    Serial.print(" | ");
-    Serial.println(buffer[i], DEC);
-
-    if (buffer[i] == TERMINATOR) break;
+    uint8_t frame[BUFFER_LENGTH];
+
+    I2CMasterTransmission transmission;
+    memset(&transmission, 0, sizeof(transmission));
+    transmission.stream.buffer = (char*)frame;
+    transmission.stream.length = build_frame(tx_seq++ & 0x7F, frame, false);
+    transmission.slave_address = DUT_ADDRESS;
+
+    //Only the transmission is timed, not building the frame
+    uint32_t start = micros();
+    enum I2CTransmissionResult result = transmit(&transmission);
+    total_us += micros() - start;
+
+    if (result != SUCCESS) errors++;
+
+    //SLA+W and data bytes are 9 clocks each, START and STOP about one more
+    bytes += transmission.bytes_transmitted;
+    *clocks += 9UL * (transmission.bytes_transmitted + 1) + 1;
   }
 
-  Serial.println("--------------------------");
-}
\ No newline at end of file
+  Serial.print("B ");
+  Serial.print(name);
+  Serial.print(' ');
+  Serial.print(BENCHMARK_FRAMES);
+  Serial.print(' ');
+  Serial.print(errors);
+  Serial.print(' ');
+  Serial.print(total_us);
+  Serial.print(' ');
+  Serial.print(bytes * 1000000UL / total_us);
+  Serial.print(' ');
+  Serial.print(*clocks * 1000000UL / total_us);
+  Serial.print(' ');
+  Serial.println(I2CSoft_stretch_count - stretches);
+
+  return total_us;
+}
+#endif
+
+#if !defined(VALIDATOR_MASTER) && !defined(VALIDATOR_BENCHMARK)
+void on_data_received(int count)
+{
+  uint32_t now = micros();
+  record_latency(now - last_frame_us);
+  last_frame_us = now;
+
+  Wire.readBytes(buffer, count);
+
+  stats.bytes += count;
+  if (verify_frame(buffer, count))
+  {
+    stats.rx_frames++;
+
+    //Answer the next request with the frame for the same seq in the same mode
+    tx_seq = buffer[0] & 0x7F;
+    digitalWrite(13, !digitalRead(13));
+  }
+}
+
+void on_data_requested()
+{
+  uint8_t frame[BUFFER_LENGTH];
+  uint8_t length = build_frame(tx_seq, frame, true);
+
+  //In non-terminator mode the master stops reading before the terminator
+  Wire.write(frame, length);
+
+  stats.tx_frames++;
+  stats.bytes += length;
+}
+#endif